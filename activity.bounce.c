@@ -50,9 +50,9 @@ bounce__on_destroy(s32 handle)
 }
 
 static void
-bounce__on_input(s32 handle, u16 poll_code)
+bounce__on_input(s32 handle, struct t_event const *event)
 {
-	app_log_info_vvv("Bounce activity (#%d) received poll code '%04x'.", handle, poll_code);
+	app_log_info_vvv("Bounce activity (#%d) received poll code '%04x'.", handle, event->code);
 }
 
 static void
@@ -114,7 +114,7 @@ bounce__on_render(s32 handle, struct frame *dst, double delta)
 	s32 const x = box.x0 + (BOX_WIDTH(&box)-1) * opaque->x;
 	s32 const y = box.y0 + (BOX_HEIGHT(&box)-1) * opaque->y;
 
-	frame_cell_at(dst, x, y)->background = gray256(255);
+	frame_cell_at(dst, x, y)->background = cell_gray(255);
 }
 
 void
@@ -3,13 +3,21 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <time.h>
 
 #include "common.h"
 #include "journal.h"
 #include "terminal.h"
 #include "draw.h"
+#include "spectate.h"
+#include "vt.h"
 #include "app.h"
 
 /* @SECTION(logging) */
@@ -180,12 +188,38 @@ app_activity_get_opaque(s32 handle, void **opaque)
 /* @SECTION(misc_services) */
 #define APP__NANO 1000000000
 
+/* @TUNABLE APP__FRAME_BUDGET (bytes of output per frame, 0 for no limit,
+ * overridden by PIANO_BUDGET) so that slow links don't fall behind */
+#ifndef APP__FRAME_BUDGET
+#  define APP__FRAME_BUDGET 0
+#endif
+
+#define APP__MIRRORS_MAX 4
+
 /* @GLOBAL */
 static struct timespec g_genesis;
+static u32             g_frame_budget = APP__FRAME_BUDGET;
+static s32             g_mirrors [APP__MIRRORS_MAX];
+static s32             g_num_mirrors;
+
+/* see `app__verify_frame` */
+static bool            g_verify;
+
+/* a virtual clock ticking by `g_clock_step` seconds per loop instead of
+ * following the real one when non-zero, see $PIANO_CLOCK */
+static double          g_clock_step;
+static double          g_clock_now;
+
+static s32             g_record_fd = -1;
 
 double
 app_sleep(double seconds)
 {
+	if (g_clock_step) {
+		g_clock_now += seconds;
+		return seconds;
+	}
+
 	struct timespec start;
 	clock_gettime(CLOCK_MONOTONIC, &start);
 
@@ -208,6 +242,10 @@ app_sleep(double seconds)
 double
 app_uptime()
 {
+	if (g_clock_step) {
+		return g_clock_now;
+	}
+
 	struct timespec now;
 	clock_gettime(CLOCK_MONOTONIC, &now);
 
@@ -222,10 +260,70 @@ app_panic_and_die(u32 code, char const *message)
 	exit(code);
 }
 
+/* Sets up a headless terminal from `size` ("<w>x<h>"), writing to stdout
+ * (or to memory to verify it, see `app__verify_frame`) and reading the
+ * keys from the file at $PIANO_INPUT, if any. */
+static void
+app__init_headless(char const *size)
+{
+	g_verify = getenv("PIANO_VERIFY");
+
+	struct t_headless headless = {
+		.width  = 80,
+		.height = 24,
+		.fd     = g_verify ? -1 : STDOUT_FILENO,
+	};
+	sscanf(size, "%dx%d", &headless.width, &headless.height);
+
+	u8 *input = NULL;
+	char const *input_path = getenv("PIANO_INPUT");
+	if (input_path) {
+		FILE *file = fopen(input_path, "rb");
+		if (!file) {
+			app_panic_and_die(1, "Could not open PIANO_INPUT!");
+		}
+
+		u32 capacity = 0;
+		for (;;) {
+			if (headless.input_size == capacity) {
+				capacity = MAX(capacity * 2, 4096);
+				if (!(input = realloc(input, capacity))) {
+					app_panic_and_die(1, "Out of memory!");
+				}
+			}
+			size_t const nread = fread(input + headless.input_size, 1, 
+				capacity - headless.input_size, file
+			);
+			if (!nread) {
+				break;
+			}
+			headless.input_size += nread;
+		}
+		fclose(file);
+		headless.input = input;
+	}
+
+	if (!t_manager_setup_headless(&headless)) {
+		app_panic_and_die(1, "Out of memory!");
+	}
+	free(input);
+
+	/* ex. PIANO_CAPS=7 to verify the encodings for REP, ECH and RGB */
+	char const *caps = getenv("PIANO_CAPS");
+	if (caps) {
+		t_capabilities_set(strtoul(caps, NULL, 0));
+	}
+}
+
 static void
 app__init_services()
 {
-	if (!t_manager_setup()) {
+	/* run without a TTY, for ex. PIANO_HEADLESS=80x24 in batch jobs */
+	char const *headless = getenv("PIANO_HEADLESS");
+	if (headless) {
+		app__init_headless(headless);
+	}
+	else if (!t_manager_setup()) {
 		app_panic_and_die(1, "Not a TTY!");
 	}
 
@@ -233,6 +331,72 @@ app__init_services()
 		app_panic_and_die(1, "Check your clock captain!");
 	}
 
+	/* for ex. PIANO_CLOCK=0.001 to run faster than realtime when headless,
+	 * time only moves by as much per loop (or as much as slept) */
+	char const *clock_step = getenv("PIANO_CLOCK");
+	if (clock_step) {
+		g_clock_step = MAX(strtod(clock_step, NULL), 0.0);
+	}
+
+	/* record the output as an asciicast, see `t_record_start` */
+	char const *record = getenv("PIANO_RECORD");
+	if (record) {
+		g_record_fd = open(record, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (g_record_fd < 0 || !t_record_start(g_record_fd, app_uptime)) {
+			app_log_warn("Could not record the output to '%s'.", record);
+		}
+	}
+
+	/* output mode, see `enum t_output_mode` */
+	char const *output_mode = getenv("PIANO_OUTPUT");
+	if (output_mode && !strcmp(output_mode, "threaded")) {
+		if (!t_output_mode_set(T_OUTPUT_THREADED)) {
+			app_log_warn("Could not start the writer thread, staying direct.");
+		}
+	}
+	else if (output_mode && !strcmp(output_mode, "nonblocking")) {
+		if (!t_output_mode_set(T_OUTPUT_NONBLOCKING)) {
+			app_log_warn("Could not make the output non-blocking, staying direct.");
+		}
+	}
+
+	/* mirror the output to a colon separated list of paths (ptys or 
+	 * recordings), see `t_sink_attach` */
+	char const *mirrors = getenv("PIANO_MIRROR");
+	while (mirrors && *mirrors && g_num_mirrors < APP__MIRRORS_MAX) {
+		char path [256];
+		u32 const length = strcspn(mirrors, ":");
+		snprintf(path, sizeof(path), "%.*s", (int) length, mirrors);
+		mirrors += length + (mirrors[length] == ':');
+
+		s32 const fd = open(path, O_WRONLY | O_NOCTTY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || t_sink_attach(fd) < 0) {
+			app_log_warn("Could not mirror the output to '%s'.", path);
+			if (fd >= 0) close(fd);
+			continue;
+		}
+		g_mirrors[g_num_mirrors++] = fd;
+	}
+
+	/* serve the frames to local spectators, encoded for the common
+	 * denominator of terminals */
+	char const *spectate = getenv("PIANO_SPECTATE");
+	if (spectate && !spectate_start(spectate, 0)) {
+		app_log_warn("Could not serve spectators at '%s'.", spectate);
+	}
+
+	/* encode large frames on as many threads, see `frame_raster_threads` */
+	char const *threads = getenv("PIANO_THREADS");
+	if (threads && !frame_raster_threads(strtoul(threads, NULL, 10))) {
+		app_log_warn("Could not start all of the %s rasterizer threads.", threads);
+	}
+
+	/* see `frame_rasterize_diff_budgeted` */
+	char const *budget = getenv("PIANO_BUDGET");
+	if (budget) {
+		g_frame_budget = strtoul(budget, NULL, 10);
+	}
+
 	/*  */
 	for (s32 i = 0; i < APP__ACTIVITY_POOL_SIZE; ++i) {
 		g_activity_pool[i].handle = -1;
@@ -242,18 +406,292 @@ app__init_services()
 static void
 app__destroy_services()
 {
+	spectate_stop();
 	t_manager_cleanup();
+	frame_raster_threads(1);
+
+	for (s32 i = 0; i < g_num_mirrors; ++i) {
+		close(g_mirrors[i]);
+	}
+	if (g_record_fd >= 0) {
+		close(g_record_fd);
+	}
 }
 
 /* @SECTION(app) */
 #define APP__UPDATE_DELTA 8e-3
 #define APP__DRAW_DELTA 8e-3
+#define APP__QUERY_TIMEOUT 0.5
+
+/* how soon to check back on a terminal that is behind without the
+ * event loop to wake up once it takes more */
+#define APP__BACKLOG_RETRY 1e-3
 
 /* @GLOBAL  */
 static bool            g_should_run       = true;
 
 
 #ifndef APP_DEMO
+/* @GLOBAL */
+static struct vt       g_verify_vt;
+static u64             g_verify_frames;
+static u64             g_verify_changed;
+static u64             g_verify_mismatched;
+
+/* Runs the output of a headless frame through a screen model and checks
+ * that it shows `frame`, keeping count of the cost per changed cell. */
+static void
+app__verify_frame(struct frame *frame)
+{
+	if (g_verify_vt.screen.width != frame->width || 
+	    g_verify_vt.screen.height != frame->height)
+	{
+		/* resizes repaint from scratch */
+		vt_free(&g_verify_vt);
+		if (!vt_init(&g_verify_vt, frame->width, frame->height)) {
+			return;
+		}
+	}
+
+	u32 size;
+	u8 const *output = t_headless_output(&size);
+
+	u32 const changed = vt_compare(&g_verify_vt, frame, NULL, NULL);
+	vt_feed(&g_verify_vt, output, size);
+	t_headless_output_clear();
+
+	s32 x, y;
+	u32 const mismatches = vt_compare(&g_verify_vt, frame, &x, &y);
+
+	++g_verify_frames;
+	g_verify_changed += changed;
+	if (mismatches) {
+		++g_verify_mismatched;
+	}
+
+	/* over budget frames are expected to catch up later */
+	if (mismatches && !g_frame_budget) {
+		app_log_warn("Frame %llu is off by %u cells, first at (%d, %d).",
+			(unsigned long long) g_verify_frames, mismatches, x, y
+		);
+	}
+	app_log_info_vvv("Frame %llu sent %u bytes for %u changed cells.",
+		(unsigned long long) g_verify_frames, size, changed
+	);
+}
+
+static void
+app__verify_report()
+{
+	u64 const bytes = g_verify_vt.num_bytes;
+	app_log_info("Verified %llu frames: %llu bytes for %llu changed cells (%.3f per cell), %llu frames off, %llu sequences unknown.",
+		(unsigned long long) g_verify_frames,
+		(unsigned long long) bytes,
+		(unsigned long long) g_verify_changed,
+		g_verify_changed ? (double) bytes / g_verify_changed : 0.0,
+		(unsigned long long) g_verify_mismatched,
+		(unsigned long long) g_verify_vt.num_unknown
+	);
+	vt_free(&g_verify_vt);
+}
+
+/* @SECTION(event_loop) */
+enum app__wake
+{
+	APP__WAKE_INPUT,
+	APP__WAKE_OUTPUT,
+	APP__WAKE_TIMER,
+	APP__WAKE_SIGNAL,
+	APP__WAKE_SPECTATORS,
+};
+
+/* @GLOBAL */
+static s32             g_loop_epoll_fd  = -1;
+static s32             g_loop_timer_fd  = -1;
+static s32             g_loop_signal_fd = -1;
+static sigset_t        g_loop_signals;
+static bool            g_loop_output_watched;
+
+/* the terminal changed size, repaint as soon as possible */
+static bool            g_resized;
+
+/* Blocks the signals the loop takes in through a signalfd, which has to
+ * be done before any threads are started so that they inherit it. */
+static void
+app__loop_block_signals()
+{
+	sigemptyset(&g_loop_signals);
+	sigaddset(&g_loop_signals, SIGWINCH);
+	sigaddset(&g_loop_signals, SIGINT);
+	sigaddset(&g_loop_signals, SIGTERM);
+	sigprocmask(SIG_BLOCK, &g_loop_signals, NULL);
+}
+
+static bool
+app__loop_watch(s32 fd, u32 events, enum app__wake wake)
+{
+	struct epoll_event event = {
+		.events = events,
+		.data.u32 = wake,
+	};
+	return epoll_ctl(g_loop_epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+static void
+app__loop_stop()
+{
+	if (g_loop_epoll_fd >= 0) close(g_loop_epoll_fd);
+	if (g_loop_timer_fd >= 0) close(g_loop_timer_fd);
+	if (g_loop_signal_fd >= 0) close(g_loop_signal_fd);
+	g_loop_epoll_fd = g_loop_timer_fd = g_loop_signal_fd = -1;
+	g_loop_output_watched = false;
+
+	sigprocmask(SIG_UNBLOCK, &g_loop_signals, NULL);
+}
+
+/* Sets up the epoll(7) set the main loop sleeps in: the input, a timer 
+ * for the next update or render, the signals and the spectators. */
+static void
+app__loop_start()
+{
+	g_loop_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	g_loop_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	g_loop_signal_fd = signalfd(-1, &g_loop_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	if (g_loop_epoll_fd < 0 || g_loop_timer_fd < 0 || g_loop_signal_fd < 0 ||
+	    !app__loop_watch(g_loop_timer_fd, EPOLLIN, APP__WAKE_TIMER) ||
+	    !app__loop_watch(g_loop_signal_fd, EPOLLIN, APP__WAKE_SIGNAL) ||
+	    (t_input_fd() >= 0 && !app__loop_watch(t_input_fd(), EPOLLIN, APP__WAKE_INPUT)) ||
+	    (spectate_fd() >= 0 && !app__loop_watch(spectate_fd(), EPOLLIN, APP__WAKE_SPECTATORS)))
+	{
+		app_log_warn("Could not set up the event loop, sleeping between frames instead.");
+		app__loop_stop();
+	}
+}
+
+/* Takes in the signals that came in. */
+static void
+app__loop_signals()
+{
+	struct signalfd_siginfo info;
+	while (read(g_loop_signal_fd, &info, sizeof(info)) == sizeof(info)) {
+		switch (info.ssi_signo) {
+		case SIGWINCH:
+			/* the terminal's own handler never sees it while blocked */
+			t_resize_notify();
+			g_resized = true;
+			break;
+
+		case SIGINT:
+		case SIGTERM:
+			app_log_info("Stopping on signal %u.", (unsigned) info.ssi_signo);
+			g_should_run = false;
+			break;
+		}
+	}
+}
+
+/* Whether the terminal is behind on non-blocking output, so that frames
+ * are better skipped: a writer thread that is behind still leaves the 
+ * other buffer free to build the next frame in. */
+static bool
+app__behind()
+{
+	return t_output_mode() == T_OUTPUT_NONBLOCKING && t_backlog() > 0;
+}
+
+/* Sleeps until there is input, a signal, something for the spectators
+ * or `deadline` (in `app_uptime` seconds) is due. A terminal behind on
+ * non-blocking output wakes it up once it takes more. */
+static void
+app__loop_wait(double deadline)
+{
+	/* the virtual clock never waits for anything, but still stops */
+	if (g_clock_step) {
+		if (g_loop_signal_fd >= 0) {
+			app__loop_signals();
+		}
+		return;
+	}
+
+	double const now = app_uptime();
+	bool const behind = app__behind();
+	bool const watch_output = behind && g_loop_epoll_fd >= 0 && 
+		t_output_fd() >= 0;
+	if (behind && !watch_output) {
+		deadline = MIN(deadline, now + APP__BACKLOG_RETRY);
+	}
+
+	if (g_loop_epoll_fd < 0) {
+		if (deadline > now) {
+			app_sleep(deadline - now);
+		}
+		return;
+	}
+
+	if (watch_output != g_loop_output_watched) {
+		if (watch_output) {
+			app__loop_watch(t_output_fd(), EPOLLOUT, APP__WAKE_OUTPUT);
+		}
+		else {
+			epoll_ctl(g_loop_epoll_fd, EPOLL_CTL_DEL, t_output_fd(), NULL);
+		}
+		g_loop_output_watched = watch_output;
+	}
+
+	if (deadline <= now) {
+		app__loop_signals();
+		return;
+	}
+
+	/* on the same clock as `app_uptime` */
+	u64 const nanoseconds = 
+		g_genesis.tv_sec * (u64) APP__NANO + g_genesis.tv_nsec + 
+		(u64) (deadline * 1e9);
+	struct itimerspec const timer = {
+		.it_value = {
+			.tv_sec  = nanoseconds / APP__NANO,
+			.tv_nsec = nanoseconds % APP__NANO,
+		},
+	};
+	timerfd_settime(g_loop_timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+
+	struct epoll_event events [8];
+	s32 const count = epoll_wait(g_loop_epoll_fd, events, ARRAY_LENGTH(events), -1);
+	if (count < 0 && errno != EINTR) {
+		app_log_warn("The event loop failed, sleeping between frames instead.");
+		app__loop_stop();
+		return;
+	}
+
+	for (s32 i = 0; i < count; ++i) {
+		switch (events[i].data.u32) {
+		case APP__WAKE_INPUT:
+			/* the terminal went away */
+			if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+				app_log_warn("Lost the terminal input, stopping.");
+				g_should_run = false;
+			}
+			break;
+
+		case APP__WAKE_TIMER: {
+			u64 expirations;
+			UNUSED(read(g_loop_timer_fd, &expirations, sizeof(expirations)));
+			break;
+		}
+
+		case APP__WAKE_SIGNAL:
+			app__loop_signals();
+			break;
+
+		/* whoever is woken up for these is taken care of in the loop */
+		case APP__WAKE_OUTPUT:
+		case APP__WAKE_SPECTATORS:
+			break;
+		}
+	}
+}
+
 extern void
 bounce_create_activity();
 
@@ -263,7 +701,18 @@ main(void)
 	/* 
 	 * Setup
 	 */
+	app__loop_block_signals();
 	app__init_services();
+	app__loop_start();
+
+	/* the rasterizer picks up whatever is detected as it comes in, 
+	 * there is nobody to answer when headless */
+	bool caps_pending = !t_headless() && t_capabilities_query(APP__QUERY_TIMEOUT);
+
+	/* clicks and drags, the reports go out with the first frame */
+	if (!t_headless()) {
+		t_mouse_enable(false);
+	}
 
 	bounce_create_activity();
 	bounce_create_activity();
@@ -271,6 +720,10 @@ main(void)
 	struct frame frame;
 	frame_alloc(&frame, 0, 0);
 
+	/* only redone when the terminal reports a new size */
+	u32 size_generation = 0;
+	struct box layout [APP__ACTIVITY_POOL_SIZE];
+
 	double tm_update_last = app_uptime();
 	double tm_render_last = app_uptime();
 
@@ -292,50 +745,181 @@ main(void)
 			}
 		}
 
-		if (tm_render_delta >= APP__DRAW_DELTA) {
+		spectate_service();
+
+		/* keep feeding a terminal that is behind */
+		if (app__behind()) {
+			t_flush();
+		}
+
+		/* and don't rasterize frames it wouldn't get to show anyway, the
+		 * next frame is diffed against what was actually sent */
+		if ((tm_render_delta >= APP__DRAW_DELTA || g_resized) && !app__behind()) {
 			tm_render_last = tm_now;
+			g_resized = false;
 
-			s32 term_w, term_h;
-			t_query_size(&term_w, &term_h);
+			u32 const generation = t_size_generation();
+			if (generation != size_generation) {
+				size_generation = generation;
 
-			frame_realloc(&frame, term_w, term_h);
+				s32 term_w, term_h;
+				t_query_size(&term_w, &term_h);
 
-			/* For simplicity, let's use the regular stack layout */
-			for (s32 i = 0; i < g_activity_tail; ++i) {
-				struct app__activity *act = g_activity_table[i];
+				frame_realloc(&frame, term_w, term_h);
 
-				s32 const y0 = (frame.height * i) / g_activity_tail;
-				s32 const y1 = (frame.height * (i+1)) / g_activity_tail;
+				/* the activities in stack order are also the order in
+				 * which their changes go out when the frame is over 
+				 * budget. For simplicity, let's use the regular stack 
+				 * layout */
+				for (s32 i = 0; i < g_activity_tail; ++i) {
+					s32 const y0 = (frame.height * i) / g_activity_tail;
+					s32 const y1 = (frame.height * (i+1)) / g_activity_tail;
 
-				frame_clip_absolute(&frame, 0, y0, frame.width, y1);
+					layout[i] = BOX(0, y0, frame.width, y1);
+				}
+			}
 
+			for (s32 i = 0; i < g_activity_tail; ++i) {
+				struct app__activity *act = g_activity_table[i];
+
+				frame_clip_absolute_box(&frame, &layout[i]);
 				act->cbs.on_render(act->handle, &frame, tm_render_delta);
 			}
 
 			frame_zero_clip(&frame);
 
-			t_reset();
-			t_clear();
-			frame_rasterize(&frame, 0, 0);
-			t_flush();
+			t_debug_metrics_frame_begin();
+			t_frame_begin();
+			if (g_frame_budget) {
+				frame_rasterize_diff_budgeted(&frame, 0, 0, 
+					g_frame_budget, layout, g_activity_tail
+				);
+			}
+			else {
+				frame_rasterize_diff(&frame, 0, 0);
+			}
+			t_frame_commit();
+			frame_rasterize_sinks();
+			spectate_frame(&frame);
+
+			if (g_verify) {
+				app__verify_frame(&frame);
+			}
+
+#ifdef TC_DEBUG_METRICS
+			struct t_debug_metrics metrics;
+			t_debug_metrics_frame(&metrics);
+			app_log_info_vvv("Frame buffered %llu bytes, flushed %llu bytes in %llu writes (%llu short), blocked %.6fs.",
+				(unsigned long long) metrics.bytes_buffered, 
+				(unsigned long long) metrics.bytes_flushed, 
+				(unsigned long long) metrics.num_writes, 
+				(unsigned long long) metrics.num_short_writes, 
+				metrics.seconds_blocked
+			);
+#endif
 		}
 
-		switch (t_poll()) {
-		case T_POLL_CODE(0, 'q'):
-			g_should_run = false;
-			break;
+		/* everything typed since the last frame, at once */
+		struct t_event events [64];
+		u32 num_events;
+		do {
+			num_events = t_poll_batch(events, ARRAY_LENGTH(events));
+			for (u32 i = 0; i < num_events; ++i) {
+				for (s32 j = 0; j < g_activity_tail; ++j) {
+					struct app__activity *act = g_activity_table[j];
+					act->cbs.on_input(act->handle, &events[i]);
+				}
+
+				switch (events[i].code) {
+				case T_POLL_CODE(0, 'q'):
+					g_should_run = false;
+					break;
+				}
+
+				/* to the frame that shows what it did */
+				t_latency_trace(events[i].time);
+			}
+		} while (num_events == ARRAY_LENGTH(events));
+
+		if (caps_pending && !t_capabilities_pending()) {
+			caps_pending = false;
+
+			struct t_terminal_info const *info = t_terminal_info();
+			app_log_info("Terminal '%s' (DA1 %u, DA2 %u/%u) has capabilities 0x%02x.",
+				info->version, 
+				(unsigned) info->conformance, 
+				(unsigned) info->type, 
+				(unsigned) info->firmware, 
+				(unsigned) info->capabilities
+			);
+		}
+
+		/* the virtual clock only moves on its own between loops */
+		if (g_clock_step) {
+			app_sleep(g_clock_step);
+		}
+
+		/* and the real one is slept through until something is due */
+		if (g_should_run) {
+			double deadline = tm_update_last + APP__UPDATE_DELTA;
+			if (!app__behind()) {
+				deadline = MIN(deadline, 
+					g_resized ? 0.0 : tm_render_last + APP__DRAW_DELTA
+				);
+			}
+
+			/* a lone ESC is taken as typed once nothing followed it */
+			double const input_timeout = t_input_timeout();
+			if (input_timeout >= 0) {
+				deadline = MIN(deadline, app_uptime() + input_timeout);
+			}
+			app__loop_wait(deadline);
 		}
 	}
 	
 	/* 
 	 * Cleanup
 	 */
+#ifdef TC_DEBUG_METRICS
+	struct t_debug_metrics metrics;
+	t_debug_metrics_total(&metrics);
+	app_log_info("Output buffered %llu bytes (%llu formatted), flushed %llu bytes in %llu writes (%llu short), blocked %.6fs, sunk %llu bytes, recorded %llu bytes.",
+		(unsigned long long) metrics.bytes_buffered, 
+		(unsigned long long) metrics.bytes_formatted, 
+		(unsigned long long) metrics.bytes_flushed, 
+		(unsigned long long) metrics.num_writes, 
+		(unsigned long long) metrics.num_short_writes, 
+		metrics.seconds_blocked,
+		(unsigned long long) metrics.bytes_sunk, 
+		(unsigned long long) metrics.bytes_recorded
+	);
+#endif
+
+	if (g_verify) {
+		app__verify_report();
+	}
+
+	struct t_latency latency;
+	t_latency(&latency);
+	if (latency.count) {
+		app_log_info("Key-to-photon latency over %llu frames: p50 %.3fms, p99 %.3fms, max %.3fms.",
+			(unsigned long long) latency.count, 
+			latency.p50 * 1e3, 
+			latency.p99 * 1e3, 
+			latency.max * 1e3
+		);
+	}
+
 	frame_free(&frame);
 
 	app__destroy_services();
 
 	_app_dump_system_journal(STDOUT_FILENO);
 
+	/* only once the terminal is restored, as a signal that came in 
+	 * meanwhile is delivered as soon as it's unblocked */
+	app__loop_stop();
+
 	return 0;
 }
 #endif /* ifndef APP_DEMO */
@@ -5,6 +5,7 @@
 #include "journal.h"
 #include "geometry.h"
 #include "draw.h"
+#include "terminal.h"
 
 /* @SECTION(logging) */
 void
@@ -38,7 +39,7 @@ struct activity_callbacks
 	void(*on_focus  )(s32 handle);
 	void(*on_unfocus)(s32 handle);
 
-	void(*on_input  )(s32 handle, u16 poll_code);
+	void(*on_input  )(s32 handle, struct t_event const *event);
 	void(*on_update )(s32 handle, double delta);
 	void(*on_render )(s32 handle, struct frame *dst, double delta);
 };
@@ -0,0 +1,117 @@
+/* Helpers for the *_check.c programs, which check terminal.c on a 
+ * headless terminal and exit with 1 if anything is off. */
+#ifndef INCLUDE__BENCHMARK_CHECK_H
+#define INCLUDE__BENCHMARK_CHECK_H
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "terminal.h"
+
+
+static int failures;
+
+static inline void
+check(bool ok, char const *what)
+{
+	if (!ok) {
+		printf("FAIL %s\n", what);
+		++failures;
+	}
+}
+
+static inline void
+wait_seconds(double seconds)
+{
+	struct timespec const ts = {
+		.tv_sec = (time_t) seconds,
+		.tv_nsec = (long) ((seconds - (time_t) seconds) * 1e9),
+	};
+	nanosleep(&ts, NULL);
+}
+
+/* Feeds `input` in pieces of `step` bytes, polling after each, then 
+ * waits out whatever is left pending and compares the codes decoded, 
+ * and the parameters where expected. */
+static inline void
+expect(
+	char const *input,
+	u32 step,
+	struct t_event const *expected,
+	u32 num_expected
+) {
+	struct t_event events [64];
+	u32 got = 0;
+	u32 const size = strlen(input);
+	for (u32 at = 0; at < size; at += step) {
+		t_headless_input((u8 const *) input + at, MIN(step, size - at));
+		got += t_poll_batch(events + got, 64 - got);
+	}
+	double const timeout = t_input_timeout();
+	if (timeout >= 0) {
+		wait_seconds(timeout + 1e-3);
+		got += t_poll_batch(events + got, 64 - got);
+	}
+
+	bool ok = got == num_expected;
+	for (u32 i = 0; ok && i < got; ++i) {
+		ok = events[i].code == expected[i].code
+			&& (!expected[i].num_params
+				|| events[i].num_params == expected[i].num_params)
+			&& !memcmp(events[i].params, expected[i].params,
+				expected[i].num_params * sizeof(u16));
+	}
+	if (!ok) {
+		printf("FAIL");
+		for (u32 i = 0; i < size; ++i) {
+			bool const control = input[i] < 0x20;
+			printf(control ? " ^%c" : " %c", input[i] + (control ? 0x40 : 0));
+		}
+		printf(" (%u at a time):", step);
+		for (u32 i = 0; i < got; ++i) {
+			printf(" %04x", events[i].code);
+			for (u32 j = 0; j < events[i].num_params; ++j) {
+				printf("%c%u", j ? ',' : '/', events[i].params[j]);
+			}
+		}
+		printf("\n");
+		++failures;
+	}
+}
+
+/* Expects the events whole, a byte at a time and three at a time. */
+#define EXPECT(input, ...) do { \
+	struct t_event const expected [] = { __VA_ARGS__ }; \
+	u32 const num = sizeof(expected) / sizeof(expected[0]); \
+	expect(input, 1 << 16, expected, num); \
+	expect(input, 1, expected, num); \
+	expect(input, 3, expected, num); \
+} while (0)
+
+#define KEY(modifiers, value) \
+	{ .code = T_POLL_CODE(modifiers, value) }
+#define MOUSE(modifiers, kind, button, x, y) \
+	{ .code = T_POLL_CODE(T_SPECIAL | (modifiers), kind), \
+	  .num_params = 3, .params = { button, x, y } }
+
+static inline bool
+check_setup()
+{
+	struct t_headless const headless = { .width = 80, .height = 24, .fd = -1 };
+	if (!t_manager_setup_headless(&headless)) {
+		puts("FAIL setup");
+		return false;
+	}
+	return true;
+}
+
+static inline int
+check_done()
+{
+	t_manager_cleanup();
+	printf("%s (%d failures)\n", failures ? "FAIL" : "OK", failures);
+	return failures != 0;
+}
+
+#endif
@@ -0,0 +1,67 @@
+/* Checks the key decoding and the replies to the capabilities query,
+ * feeding in known bytes. */
+#include "check.h"
+
+
+static void
+check_keys()
+{
+	EXPECT("ab", KEY(0, 'a'), KEY(0, 'b'));
+	EXPECT("\r\t\x01", KEY(T_CONTROL, 'M'), KEY(T_CONTROL, 'I'), KEY(T_CONTROL, 'A'));
+	EXPECT("\x1b" "a", KEY(T_ALT, 'a'));
+	EXPECT("\x1b", KEY(T_CONTROL, '['));
+	EXPECT("\x1b\x1b[A", KEY(T_CONTROL, '['), KEY(T_SPECIAL, T_UP));
+	EXPECT("\x1b[A\x1b[B", KEY(T_SPECIAL, T_UP), KEY(T_SPECIAL, T_DOWN));
+	EXPECT("\x1b[1;5C", KEY(T_SPECIAL | T_CONTROL, T_RIGHT));
+	EXPECT("\x1bOP\x1bOA", KEY(T_SPECIAL, T_F1), KEY(T_SPECIAL, T_UP));
+	EXPECT("\x1b[15~\x1b[24;2~",
+		KEY(T_SPECIAL, T_F5), KEY(T_SPECIAL | T_SHIFT, T_F12));
+	EXPECT("\x1b[999999999999A", KEY(T_SPECIAL, T_UP));
+	EXPECT("\x1b[", KEY(T_ALT, '['));
+	EXPECT("\x1bO", KEY(T_ALT, 'O'));
+
+	/* a sequence cut right after its ESC is held until the rest is in */
+	struct t_event events [4];
+	t_headless_input((u8 const *) "\x1b", 1);
+	u32 const held = t_poll_batch(events, 4);
+	check(!held && t_input_timeout() > 0, "cut sequence held");
+	t_headless_input((u8 const *) "[A", 2);
+	u32 const got = t_poll_batch(events, 4);
+	check(got == 1 && events[0].code == T_POLL_CODE(T_SPECIAL, T_UP), 
+		"cut sequence completed");
+	check(t_input_timeout() < 0, "nothing held");
+}
+
+static void
+check_replies()
+{
+	/* a query that timed out, then its replies, none of them keys */
+	t_capabilities_query(0);
+	struct t_event events [4];
+	t_poll_batch(events, 4);
+	check(!t_capabilities_pending(), "query timed out");
+	t_headless_output_clear();
+
+	EXPECT("\x1bP>|XTerm(388)\x1b\\" "\x1b[?62;22c" "x", KEY(0, 'x'));
+	check(!strcmp(t_terminal_info()->version, "XTerm(388)"), "late version");
+
+	/* ESC typed while waiting for replies, and alt+shift+p after them */
+	t_capabilities_query(5);
+	t_headless_output_clear();
+	EXPECT("\x1b", KEY(T_CONTROL, '['));
+	check(t_capabilities_pending(), "query pending");
+	t_headless_input((u8 const *) "\x1b[?62;22c", 9);
+	check(!t_poll_batch(events, 4) && !t_capabilities_pending(), "query answered");
+	EXPECT("\x1bP", KEY(T_ALT, 'P'));
+}
+
+int
+main(void)
+{
+	if (!check_setup()) {
+		return 1;
+	}
+	check_keys();
+	check_replies();
+	return check_done();
+}
@@ -0,0 +1,59 @@
+/* Checks the latency summary against frames showing input traced with
+ * known delays. */
+#include "check.h"
+
+
+static double
+now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+frame(bool changed)
+{
+	t_frame_begin();
+	if (changed) {
+		t_writez("x");
+	}
+	t_frame_commit();
+	t_headless_output_clear();
+}
+
+static void
+check_latency()
+{
+	struct t_latency latency;
+
+	/* nothing to show, nothing recorded */
+	t_latency_trace(now());
+	frame(false);
+	frame(true);
+	t_latency(&latency);
+	check(latency.count == 0 && latency.max == 0, "latency without a change");
+
+	/* 1..100 ms, only the oldest of a frame counts */
+	for (u32 i = 1; i <= 100; ++i) {
+		double const time = now();
+		t_latency_trace(time - i * 1e-3);
+		t_latency_trace(time);
+		frame(true);
+	}
+	t_latency(&latency);
+	check(latency.count == 100, "latency count");
+	check(latency.max > 0.0999 && latency.max < 0.102, "latency max");
+	check(latency.p50 > 0.0499 && latency.p50 < 0.050 * 1.0625 + 0.002, "latency p50");
+	check(latency.p99 > 0.0989 && latency.p99 <= latency.max, "latency p99");
+}
+
+int
+main(void)
+{
+	if (!check_setup()) {
+		return 1;
+	}
+	check_latency();
+	return check_done();
+}
@@ -0,0 +1,55 @@
+/* Checks the SGR mouse reports and the merging of their motion, feeding
+ * in known bytes. */
+#include "check.h"
+
+
+static void
+check_mouse()
+{
+	/* the motion read at once is merged, keeping the latest position,
+	 * but not across the key or the release */
+	struct t_event const merged [] = {
+		MOUSE(0, T_MOUSE_PRESS, T_MOUSE_LEFT, 9, 4),
+		MOUSE(0, T_MOUSE_MOTION, T_MOUSE_LEFT, 11, 4),
+		KEY(0, 'x'),
+		MOUSE(0, T_MOUSE_MOTION, T_MOUSE_LEFT, 13, 5),
+		MOUSE(0, T_MOUSE_RELEASE, T_MOUSE_LEFT, 13, 5),
+	};
+	expect("\x1b[<0;10;5M\x1b[<32;11;5M\x1b[<32;12;5M" "x"
+		"\x1b[<32;14;6M\x1b[<0;14;6m", 1 << 16,
+		merged, sizeof(merged) / sizeof(merged[0])
+	);
+	EXPECT("\x1b[<65;3;3M\x1b[<20;1;1M\x1b[<35;5;7M",
+		MOUSE(0, T_MOUSE_WHEEL, T_MOUSE_WHEEL_DOWN, 2, 2),
+		MOUSE(T_SHIFT | T_CONTROL, T_MOUSE_PRESS, T_MOUSE_LEFT, 0, 0),
+		MOUSE(0, T_MOUSE_MOTION, T_MOUSE_NONE, 4, 6),
+	);
+
+	/* motion that is not taken yet is merged into by the next read */
+	struct t_event events [4];
+	t_headless_input((u8 const *) "\x1b[<0;10;5M\x1b[<32;11;5M", 21);
+	u32 const pressed = t_poll_batch(events, 1);
+	t_headless_input((u8 const *) "\x1b[<32;12;5M", 11);
+	u32 const moved = t_poll_batch(events + 1, 3);
+	check(pressed == 1 && moved == 1 && 
+		events[1].code == T_POLL_CODE(T_SPECIAL, T_MOUSE_MOTION) && 
+		events[1].params[1] == 11, "motion merged across reads");
+
+	/* motion taken by a poll already is not merged into */
+	t_headless_input((u8 const *) "\x1b[<35;5;7M", 10);
+	u32 first = t_poll_batch(events, 4);
+	t_headless_input((u8 const *) "\x1b[<35;6;7M", 10);
+	u32 second = t_poll_batch(events, 4);
+	check(first == 1 && second == 1 && events[0].params[1] == 5,
+		"taken motion merged into");
+}
+
+int
+main(void)
+{
+	if (!check_setup()) {
+		return 1;
+	}
+	check_mouse();
+	return check_done();
+}
@@ -0,0 +1,34 @@
+/* Checks that the size generation changes with the size, and only then. */
+#include "check.h"
+
+
+static void
+check_size()
+{
+	s32 w, h;
+	u32 const generation = t_size_generation();
+	t_query_size(&w, &h);
+	check(w == 80 && h == 24, "size");
+
+	t_resize_notify();
+	check(t_size_generation() == generation, "generation without a change");
+	t_headless_resize(80, 24);
+	check(t_size_generation() == generation, "generation for the same size");
+	t_headless_resize(100, 30);
+	t_headless_resize(120, 40);
+	check(t_size_generation() != generation, "generation after a resize");
+	t_query_size(&w, &h);
+	check(w == 120 && h == 40, "size after a resize");
+	u32 const resized = t_size_generation();
+	check(t_size_generation() == resized, "generation without a resize");
+}
+
+int
+main(void)
+{
+	if (!check_setup()) {
+		return 1;
+	}
+	check_size();
+	return check_done();
+}
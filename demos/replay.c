@@ -0,0 +1,210 @@
+/* Plays back an asciicast v2 recording (see `t_record_start`) from the
+ * file at $PIANO_REPLAY, at the speed in $PIANO_REPLAY_SPEED (1 by
+ * default, 0 for as fast as the output goes), then reports the
+ * throughput on stderr. With $PIANO_HEADLESS it makes a reproducible
+ * benchmark of the output path. */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <terminal.h>
+#include <app.h>
+
+
+/* Reads the 4 hex digits of a \u escape at `in`. */
+static bool
+replay__hex4(char const *in, u32 *out_point)
+{
+	char hex [5] = {0};
+	memcpy(hex, in, 4);
+	if (strlen(hex) != 4 || strspn(hex, "0123456789abcdefABCDEF") != 4) {
+		return false;
+	}
+	*out_point = strtoul(hex, NULL, 16);
+	return true;
+}
+
+/* Encodes code point `point` as UTF-8 at `out`. */
+static u8 *
+replay__utf8(u8 *out, u32 point)
+{
+	if (point < 0x80) {
+		*out++ = point;
+	}
+	else if (point < 0x800) {
+		*out++ = 0xc0 | (point >> 6);
+		*out++ = 0x80 | (point & 0x3f);
+	}
+	else if (point < 0x10000) {
+		*out++ = 0xe0 | (point >> 12);
+		*out++ = 0x80 | ((point >> 6) & 0x3f);
+		*out++ = 0x80 | (point & 0x3f);
+	}
+	else {
+		*out++ = 0xf0 | (point >> 18);
+		*out++ = 0x80 | ((point >> 12) & 0x3f);
+		*out++ = 0x80 | ((point >> 6) & 0x3f);
+		*out++ = 0x80 | (point & 0x3f);
+	}
+	return out;
+}
+
+/* Decodes the JSON string starting after the opening quote at `in` into
+ * `out` (which may be `in`), false if it is malformed. */
+static bool
+replay__decode(char const *in, u8 *out, u32 *out_size)
+{
+	u8 const *base = out;
+
+	while (*in != '"') {
+		if (!*in) {
+			return false;
+		}
+		if (*in != '\\') {
+			*out++ = *in++;
+			continue;
+		}
+
+		++in;
+		switch (*in++) {
+		case 'n': *out++ = '\n'; break;
+		case 'r': *out++ = '\r'; break;
+		case 't': *out++ = '\t'; break;
+		case 'b': *out++ = '\b'; break;
+		case 'f': *out++ = '\f'; break;
+		case '"': *out++ = '"';  break;
+		case '/': *out++ = '/';  break;
+		case '\\': *out++ = '\\'; break;
+
+		case 'u': {
+			u32 point;
+			if (!replay__hex4(in, &point)) {
+				return false;
+			}
+			in += 4;
+
+			/* a surrogate pair makes one code point past U+FFFF, a 
+			 * surrogate on its own none at all */
+			if (0xd800 <= point && point < 0xdc00) {
+				u32 low;
+				if (in[0] == '\\' && in[1] == 'u' && replay__hex4(in + 2, &low) &&
+				    0xdc00 <= low && low < 0xe000)
+				{
+					point = 0x10000 + ((point - 0xd800) << 10) + (low - 0xdc00);
+					in += 6;
+				}
+				else {
+					point = 0xfffd;
+				}
+			}
+			else if (0xdc00 <= point && point < 0xe000) {
+				point = 0xfffd;
+			}
+			out = replay__utf8(out, point);
+			break;
+		}
+
+		default:
+			return false;
+		}
+	}
+
+	*out_size = out - base;
+	return true;
+}
+
+static double
+replay__now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+int
+demo()
+{
+	char const *path = getenv("PIANO_REPLAY");
+	if (!path) {
+		fputs("Set PIANO_REPLAY to the recording to play.\n", stderr);
+		return 0;
+	}
+
+	char const *speed_string = getenv("PIANO_REPLAY_SPEED");
+	double const speed = speed_string ? strtod(speed_string, NULL) : 1.0;
+
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "Could not open '%s'.\n", path);
+		return 1;
+	}
+
+	char *line = NULL;
+	size_t line_capacity = 0;
+
+	/* the header, playing back at the recorded size when headless */
+	if (getline(&line, &line_capacity, file) < 0 || !strstr(line, "\"version\": 2")) {
+		fprintf(stderr, "'%s' is not an asciicast v2 recording.\n", path);
+		free(line);
+		fclose(file);
+		return 1;
+	}
+	char const *width = strstr(line, "\"width\":");
+	char const *height = strstr(line, "\"height\":");
+	if (t_headless() && width && height) {
+		t_headless_resize(atoi(width + 8), atoi(height + 9));
+	}
+
+	double const uptime_start = app_uptime();
+	double const real_start = replay__now();
+	u64 num_bytes = 0;
+	u64 num_events = 0;
+	u64 num_skipped = 0;
+
+	while (getline(&line, &line_capacity, file) >= 0) {
+		char *cursor = line;
+		double const time = strtod(cursor + (*cursor == '['), &cursor);
+
+		/* only output events matter, their data follows the type */
+		char *type = strchr(cursor, '"');
+		char *data = type ? strstr(type + 1, ", \"") : NULL;
+		u32 size;
+		if (!data || strncmp(type, "\"o\"", 3) ||
+		    !replay__decode(data + 3, (u8 *) line, &size))
+		{
+			++num_skipped;
+			continue;
+		}
+
+		if (speed > 0) {
+			double const ahead = time / speed - (app_uptime() - uptime_start);
+			if (ahead > 0) {
+				app_sleep(ahead);
+			}
+		}
+
+		t_write((u8 const *) line, size);
+		t_flush();
+		if (t_headless()) {
+			/* the output kept in memory is of no further use */
+			t_headless_output_clear();
+		}
+
+		num_bytes += size;
+		++num_events;
+	}
+
+	double const elapsed = replay__now() - real_start;
+	free(line);
+	fclose(file);
+
+	fprintf(stderr, "Replayed %llu events (%llu skipped), %llu bytes in %.3fs (%.1f MB/s).\n",
+		(unsigned long long) num_events,
+		(unsigned long long) num_skipped,
+		(unsigned long long) num_bytes,
+		elapsed,
+		elapsed > 0 ? num_bytes / elapsed * 1e-6 : 0.0
+	);
+	return 0;
+}
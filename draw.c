@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include "geometry.h"
 #include "terminal.h"
@@ -21,21 +22,23 @@ frame_realloc(struct frame *frame, s32 width, s32 height)
 
 	if (requested_size > frame->alloc.grid_alloc_usable_size) {
 
+		/* realloc(3) already releases the old grid when it moves it */
 		struct cell *new_grid;
 		if (!(new_grid = realloc(frame->grid, requested_size))) {
 			/* @TODO log inconvenience */
 			goto e_realloc;
 		}
 
-		free(frame->grid);
 		frame->grid = new_grid;
-		frame->width = width;
-		frame->height = height;
 
 		frame->alloc.grid_alloc_base = new_grid;
 		frame->alloc.grid_alloc_size = requested_size;
 		frame->alloc.grid_alloc_usable_size = requested_size;
 	}
+
+	/* shrinking reuses the grid, but the dimensions must still follow */
+	frame->width = width;
+	frame->height = height;
 	return frame;
 
 e_realloc:
@@ -113,6 +116,50 @@ frame_load_pattern(struct frame *frame, s32 x, s32 y, char const *pattern)
 	return num_emplaced;
 }
 
+struct frame *
+frame_scroll(struct frame *frame, struct box const *box, s32 dy)
+{
+	struct box area;
+	box_intersect(&area, &BOX_SCREEN(frame->width, frame->height), box);
+
+	s32 const width = area.x1 - area.x0;
+	s32 const height = area.y1 - area.y0;
+	if (!dy || width <= 0 || height <= 0) {
+		return frame;
+	}
+
+	s32 const shift = MIN(ABS(dy), height);
+
+	/* move the rows that stay in view, starting from the far end so
+	 * none are overwritten before they move */
+	for (s32 k = 0; k < height - shift; ++k) {
+		s32 const j = dy > 0 ? area.y1 - 1 - k : area.y0 + k;
+		memcpy(
+			frame_cell_at(frame, area.x0, j), 
+			frame_cell_at(frame, area.x0, j - dy), 
+			sizeof(struct cell) * width
+		);
+	}
+	for (s32 k = 0; k < shift; ++k) {
+		s32 const j = dy > 0 ? area.y0 + k : area.y1 - 1 - k;
+		memset(frame_cell_at(frame, area.x0, j), 0, sizeof(struct cell) * width);
+	}
+
+	/* dropping a scroll only costs bytes, the diff is correct anyway */
+	struct frame_scroll *last = frame->num_scrolls ? 
+		&frame->scrolls[frame->num_scrolls - 1] : NULL;
+	if (last && !memcmp(&last->box, &area, sizeof(area))) {
+		last->dy += dy;
+	}
+	else if (frame->num_scrolls < FRAME_SCROLLS_MAX) {
+		frame->scrolls[frame->num_scrolls++] = (struct frame_scroll) {
+			.box = area,
+			.dy = dy,
+		};
+	}
+	return frame;
+}
+
 /* @SECTION(frame_stencil) */
 u32
 frame_stencil_cmp(struct frame *frame, u8 mask, s32 reference)
@@ -129,8 +176,8 @@ frame_stencil_cmp(struct frame *frame, u8 mask, s32 reference)
 	for (s32 j = box.y0; j < box.y1; ++j) {
 		for (s32 i = box.x0; i < box.x1; ++i) {
 			struct cell *cell = frame_cell_at(frame, i, j);
-			u8 const foreground = generic_mask.foreground & (cell->foreground - reference);
-			u8 const background = generic_mask.background & (cell->background - reference);
+			u8 const foreground = cell_color_fold(generic_mask.foreground & (cell->foreground - reference));
+			u8 const background = cell_color_fold(generic_mask.background & (cell->background - reference));
 			s8 const content    = generic_mask.content    & (cell->content - reference);
 			s8 const stencil    = generic_mask.stencil    & (cell->stencil - reference);
 
@@ -157,8 +204,8 @@ frame_stencil_test(struct frame *frame, u8 mask, u8 reference)
 	for (s32 j = box.y0; j < box.y1; ++j) {
 		for (s32 i = box.x0; i < box.x1; ++i) {
 			struct cell *cell = frame_cell_at(frame, i, j);
-			u8 const foreground = generic_mask.foreground & (cell->foreground & reference);
-			u8 const background = generic_mask.background & (cell->background & reference);
+			u8 const foreground = cell_color_fold(generic_mask.foreground & (cell->foreground & reference));
+			u8 const background = cell_color_fold(generic_mask.background & (cell->background & reference));
 			s8 const content    = generic_mask.content    & (cell->content & reference);
 			s8 const stencil    = generic_mask.stencil    & (cell->stencil & reference);
 
@@ -437,6 +484,902 @@ frame_typeset_flrr(struct frame *dst, struct box *out_bb, s32 x, s32 y, s32 widt
 	return num_written;
 }
 
+/* @SECTION(frame_rasterize) */
+struct frame__raster
+{
+	/* How much was actually written out to the terminal in bytes, we're
+	 * mostly interested if this remains 0. @TODO maybe make this part 
+	 * of the actual terminal interface because keeping track of these 
+	 * additions is annoying. */
+	u32 throughput;
+
+	/* where the terminal cursor is believed to be */
+	s32 prior_x;
+	s32 prior_y;
+
+	/* the current colors, unless `!sgr_known` */
+	cell_color prior_fg;
+	cell_color prior_bg;
+	bool       sgr_known;
+
+	/* see `t_capabilities` */
+	u32 caps;
+	s32 term_w;
+
+	/* stop emitting spans once `throughput` reaches it */
+	u32 budget;
+
+	/* the front rows diffed against are blank, so repainted rows can
+	 * come from the run cache (see `frame__raster_row_cached`) */
+	bool front_blank;
+
+	/* the run cache is kept for the master terminal, passes for the 
+	 * sinks and spectators would only keep evicting its rows */
+	bool cached;
+};
+
+/* @GLOBAL */
+/* What the master terminal is believed to show (in terminal coordinates),
+ * as of the last `frame_rasterize_diff`. Empty cells are all zero. */
+static struct frame           g_front;
+static bool                   g_front_stale = true;
+
+/* the row a budgeted diff ran out on, where the next one carries on */
+static s32                    g_budget_row;
+
+static inline void
+frame__raster_init(struct frame__raster *raster, s32 term_w)
+{
+	raster->throughput = 0;
+	raster->caps = t_capabilities();
+	raster->term_w = term_w;
+	raster->budget = UINT32_MAX;
+	raster->front_blank = false;
+	raster->cached = true;
+
+	/* any constants less than -1 required for init position to
+	 * push through initial positions onto the terminal */
+	raster->prior_x = INT16_MIN;
+	raster->prior_y = INT16_MIN;
+
+	/* the first color change will include a reset */
+	raster->prior_fg = 0;
+	raster->prior_bg = 0;
+	raster->sgr_known = false;
+}
+
+/* CSI n <final> for cursor movements, whose parameter defaults to one */
+static inline u32
+frame__csi1_size(u32 n)
+{
+	return n == 1 ? 3 : t_csi_n_size(n);
+}
+
+static inline u32
+frame__csi1(u32 n, u8 final)
+{
+	if (n == 1) {
+		u8 const seq [] = { '\x1b', '[', final };
+		return t_write(seq, sizeof(seq));
+	}
+	return t_write_csi_n(n, final);
+}
+
+enum frame__move_x
+{
+	FRAME__MOVE_X_NONE,
+	FRAME__MOVE_X_BS,       /* \b per column */
+	FRAME__MOVE_X_CUF,
+	FRAME__MOVE_X_CUB,
+	FRAME__MOVE_X_CR,
+	FRAME__MOVE_X_CR_CUF,
+	FRAME__MOVE_X_CHA,
+};
+
+/* Picks the cheapest way of getting from column `from` (or anywhere if
+ * negative) to column `to` without changing rows. */
+static inline enum frame__move_x
+frame__plan_move_x(s32 from, s32 to, u32 *out_cost)
+{
+	enum frame__move_x plan = FRAME__MOVE_X_CHA;
+	u32 cost = frame__csi1_size(to + 1);
+
+#define FRAME__CONSIDER(Plan, Cost) \
+	if ((Cost) < cost) { \
+		plan = (Plan); \
+		cost = (Cost); \
+	}
+
+	if (to == 0) {
+		FRAME__CONSIDER(FRAME__MOVE_X_CR, 1);
+	}
+	else {
+		FRAME__CONSIDER(FRAME__MOVE_X_CR_CUF, 1 + frame__csi1_size(to));
+	}
+
+	if (from >= 0) {
+		if (from == to) {
+			FRAME__CONSIDER(FRAME__MOVE_X_NONE, 0);
+		}
+		else if (from < to) {
+			FRAME__CONSIDER(FRAME__MOVE_X_CUF, frame__csi1_size(to - from));
+		}
+		else {
+			FRAME__CONSIDER(FRAME__MOVE_X_BS, (u32) (from - to));
+			FRAME__CONSIDER(FRAME__MOVE_X_CUB, frame__csi1_size(from - to));
+		}
+	}
+#undef FRAME__CONSIDER
+
+	*out_cost = cost;
+	return plan;
+}
+
+static inline u32
+frame__move_x(enum frame__move_x plan, s32 from, s32 to)
+{
+	switch (plan) {
+	case FRAME__MOVE_X_NONE:
+		return 0;
+
+	case FRAME__MOVE_X_BS: {
+		u8 const bs [] = "\b\b\b";
+		u32 written = 0;
+		for (s32 n = from - to; n > 0; n -= 3) {
+			written += t_write(bs, MIN(n, 3));
+		}
+		return written;
+	}
+
+	case FRAME__MOVE_X_CUF:
+		return frame__csi1(to - from, 'C');
+
+	case FRAME__MOVE_X_CUB:
+		return frame__csi1(from - to, 'D');
+
+	case FRAME__MOVE_X_CR:
+		return t_writec('\r');
+
+	case FRAME__MOVE_X_CR_CUF:
+		return t_writec('\r') + frame__csi1(to, 'C');
+
+	case FRAME__MOVE_X_CHA:
+	default:
+		return frame__csi1(to + 1, 'G');
+	}
+}
+
+/**
+ * Moves the cursor with whichever encoding costs the fewest bytes among
+ * CUP, CR + LF, the relative moves, BS and CHA/VPA. 
+ *
+ * A cursor sitting past the last column (after writing into it) is in
+ * the "pending wrap" state, which terminals don't agree on, so its 
+ * column is treated as unknown.
+ *
+ * @NOTE(max): \n is only ever sent right after \r, which keeps it
+ * correct whether or not the tty translates it into \r\n (ONLCR).
+ */
+static inline void
+frame__raster_move(struct frame__raster *raster, s32 dst_x, s32 dst_y)
+{
+	s32 const from_x = raster->prior_x < raster->term_w ? raster->prior_x : -1;
+	s32 const from_y = raster->prior_y;
+
+	raster->prior_x = dst_x;
+	raster->prior_y = dst_y;
+
+	if (from_x == dst_x && from_y == dst_y) {
+		return;
+	}
+
+	/* absolute, the parameters default to 1 and may be omitted */
+	u32 const cost_cup = 
+		dst_y == 0 && dst_x == 0 ? 3 :
+		dst_x == 0 ? t_csi_n_size(dst_y + 1) :
+		t_csi_n_size(dst_y + 1) + t_csi_n_size(dst_x + 1) - 2;
+
+	if (from_y < 0) {
+		goto cup;
+	}
+
+	/* vertical then horizontal */
+	s32 const delta_y = dst_y - from_y;
+	u32 cost_y = 0;
+	u8 final_y = 0;
+	u32 param_y = 0;
+
+	if (delta_y) {
+		final_y = delta_y > 0 ? 'B' : 'A';
+		param_y = ABS(delta_y);
+		cost_y = frame__csi1_size(param_y);
+
+		if (frame__csi1_size(dst_y + 1) < cost_y) {
+			final_y = 'd';
+			param_y = dst_y + 1;
+			cost_y = frame__csi1_size(param_y);
+		}
+	}
+
+	u32 cost_x;
+	enum frame__move_x const plan_x = frame__plan_move_x(from_x, dst_x, &cost_x);
+
+	/* carriage return and line feeds, then horizontal from column 0 */
+	u32 cost_crlf = UINT32_MAX;
+	u32 cost_crlf_x = 0;
+	enum frame__move_x plan_crlf_x = FRAME__MOVE_X_NONE;
+
+	if (delta_y > 0 && delta_y <= 8) {
+		plan_crlf_x = frame__plan_move_x(0, dst_x, &cost_crlf_x);
+		cost_crlf = 1 + delta_y + cost_crlf_x;
+	}
+
+	if (cost_cup <= cost_y + cost_x && cost_cup <= cost_crlf) {
+		goto cup;
+	}
+
+	if (cost_crlf < cost_y + cost_x) {
+		u8 const crlf [] = "\r\n\n\n\n\n\n\n\n";
+		raster->throughput += t_write(crlf, 1 + delta_y);
+		raster->throughput += frame__move_x(plan_crlf_x, 0, dst_x);
+		return;
+	}
+
+	if (final_y) {
+		raster->throughput += frame__csi1(param_y, final_y);
+	}
+	raster->throughput += frame__move_x(plan_x, from_x, dst_x);
+	return;
+
+cup:
+	if (dst_x == 0) {
+		raster->throughput += frame__csi1(dst_y + 1, 'H');
+	}
+	else {
+		raster->throughput += t_cursor_pos(dst_x + 1, dst_y + 1);
+	}
+}
+
+/* Emits a single SGR sequence holding only the colors that changed. */
+static inline void
+frame__raster_color(
+	struct frame__raster *raster, 
+	cell_color foreground, 
+	cell_color background
+) {
+	u8 select = 0;
+
+	if (raster->sgr_known) {
+		if (foreground != raster->prior_fg) select |= T_SGR_FOREGROUND;
+		if (background != raster->prior_bg) select |= T_SGR_BACKGROUND;
+		if (!select) {
+			return;
+		}
+
+		/* going back to a default color is a byte shorter as a reset
+		 * (0 rather than 39/49), provided any other color is set 
+		 * again anyway. */
+		bool const to_default = 
+			(select & T_SGR_FOREGROUND && !foreground) ||
+			(select & T_SGR_BACKGROUND && !background);
+		bool const others_set = 
+			(!foreground || select & T_SGR_FOREGROUND) &&
+			(!background || select & T_SGR_BACKGROUND);
+		if (to_default && others_set) {
+			select |= T_SGR_RESET;
+		}
+	}
+	else {
+		select = T_SGR_RESET | T_SGR_FOREGROUND | T_SGR_BACKGROUND;
+	}
+
+	raster->throughput += t_write_sgr(select, foreground, background);
+	raster->prior_fg = foreground;
+	raster->prior_bg = background;
+	raster->sgr_known = true;
+}
+
+/* Emits a horizontal run of content sharing the same colors. */
+static inline void
+frame__raster_span(
+	struct frame__raster *raster,
+	cell_color foreground,
+	cell_color background,
+	u8 const *content,
+	s32 length,
+	s32 dst_x,
+	s32 dst_y
+) {
+	frame__raster_move(raster, dst_x, dst_y);
+	frame__raster_color(raster, foreground, background);
+
+	if (!(raster->caps & (T_CAP_REP | T_CAP_ERASE))) {
+		raster->throughput += t_write(content, length);
+		raster->prior_x += length; /* the cursor advances right when writing */
+		return;
+	}
+
+	/* Otherwise, look for runs of the same character that are cheaper
+	 * to repeat or erase than to send literally. */
+	s32 literal = 0;
+	s32 i = 0;
+
+	while (i < length) {
+		s32 run = 1;
+		while (i + run < length && content[i + run] == content[i]) {
+			++run;
+		}
+
+		/* erasing doesn't move the cursor, so only trailing blanks */
+		if (raster->caps & T_CAP_ERASE && 
+		    content[i] == ' ' && 
+		    i + run == length)
+		{
+			bool const to_eol = dst_x + length == raster->term_w;
+			u32 const cost = to_eol ? 
+				sizeof(T_ERASE_LINE_RIGHT) - 1 : t_csi_n_size(run);
+
+			if (cost < run) {
+				raster->throughput += t_write(content + literal, i - literal);
+				raster->throughput += to_eol ? t_erase_line_right() : t_erase_chars(run);
+				raster->prior_x = dst_x + i;
+				return;
+			}
+		}
+
+		if (raster->caps & T_CAP_REP &&
+		    1 + t_csi_n_size(run - 1) < run)
+		{
+			raster->throughput += t_write(content + literal, i + 1 - literal);
+			raster->throughput += t_repeat(run - 1);
+			literal = i + run;
+		}
+		i += run;
+	}
+
+	raster->throughput += t_write(content + literal, length - literal);
+	raster->prior_x = dst_x + length;
+}
+
+/* Two cells look the same on the terminal; empty cells are blank no
+ * matter their colors and the stencil is never shown. */
+static inline bool
+frame__cell_seen_eq(struct cell const *a, struct cell const *b)
+{
+	return a->content == b->content && (!a->content || (
+		a->foreground == b->foreground &&
+		a->background == b->background
+	));
+}
+
+/* How a cell is actually drawn, empty cells are wiped with a blank. */
+static inline struct cell
+frame__cell_shown(struct cell const *cell)
+{
+	if (cell->content) {
+		return (struct cell){ 
+			.foreground = cell->foreground,
+			.background = cell->background,
+			.content = cell->content,
+		};
+	}
+	return (struct cell){ .content = ' ' };
+}
+
+/* The number (up to 3) of unchanged cells from `i` on which could be 
+ * sent again in the colors of `head` to reach a changed cell, or 0. */
+static inline s32
+frame__raster_gap(
+	struct cell const *row,
+	struct cell const *front,
+	s32 i,
+	s32 count,
+	struct cell const *head
+) {
+	for (s32 k = i; k < MIN(i + 4, count); ++k) {
+		if (!frame__cell_seen_eq(&row[k], &front[k])) {
+			return k - i;
+		}
+
+		struct cell const now = frame__cell_shown(&row[k]);
+		if (now.foreground != head->foreground ||
+		    now.background != head->background)
+		{
+			return 0;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Rasterizes a row of `count` cells starting at (dst_x, dst_y) on the
+ * terminal, coalescing cells of the same colors into spans.
+ *
+ * Without a `front` row, empty cells are skipped. Otherwise only cells
+ * differing from `front` are emitted (wiping emptied cells) and `front`
+ * is updated to match, which stops after the span that exhausts the 
+ * raster's budget.
+ *
+ * `scratch` must hold at least `count` bytes.
+ */
+static void
+frame__raster_row(
+	struct frame__raster *raster,
+	struct cell const *row,
+	struct cell *front,
+	s32 count,
+	s32 dst_x,
+	s32 dst_y,
+	u8 *scratch
+) {
+	s32 i = 0;
+	while (i < count && raster->throughput < raster->budget) {
+		if (front ? frame__cell_seen_eq(&row[i], &front[i]) : !row[i].content) {
+			++i;
+			continue;
+		}
+
+		struct cell const head = frame__cell_shown(&row[i]);
+		s32 const start = i;
+
+		while (i < count) {
+			if (front ? frame__cell_seen_eq(&row[i], &front[i]) : !row[i].content) {
+				/* sending a few unchanged cells again is cheaper than
+				 * any cursor movement over them */
+				s32 const gap = front ? 
+					frame__raster_gap(row, front, i, count, &head) : 0;
+				if (!gap) {
+					break;
+				}
+				for (s32 k = i; k < i + gap; ++k) {
+					scratch[k - start] = frame__cell_shown(&row[k]).content;
+				}
+				i += gap;
+				continue;
+			}
+
+			struct cell const now = frame__cell_shown(&row[i]);
+			if (now.foreground != head.foreground ||
+			    now.background != head.background)
+			{
+				break;
+			}
+
+			scratch[i - start] = now.content;
+			if (front) {
+				front[i] = row[i].content ? now : (struct cell){0};
+			}
+			++i;
+		}
+
+		frame__raster_span(raster, 
+			head.foreground, head.background,
+			scratch, i - start, 
+			dst_x + start, dst_y
+		);
+	}
+}
+
+/* @SECTION(run_cache) */
+/* @TUNABLE FRAME_RUN_CACHE (whether repainted rows are kept encoded, 0 
+ * to encode them anew every time) */
+#ifndef FRAME_RUN_CACHE
+#  define FRAME_RUN_CACHE 1
+#endif
+
+/* The cells last repainted on a terminal row and what they were encoded
+ * to. The encoding only depends on how the cells look, where they are
+ * and the state of the raster it started in, which make the key. */
+struct frame__run
+{
+	/* the key, no cells if there is none */
+	struct cell          *cells;
+	s32                   num_cells;
+	u32                   cells_capacity;
+	s32                   dst_x;
+	bool                  diffed;
+	struct frame__raster  entry;
+
+	/* the encoding, and the state of the raster it ends in */
+	u8                   *bytes;
+	u32                   size;
+	u32                   bytes_capacity;
+	struct frame__raster  exit;
+};
+
+/* @GLOBAL */
+/* by terminal row, only ever resized between rasters (the bands each
+ * use rows of their own) */
+static struct frame__run     *g_runs;
+static s32                    g_num_runs;
+
+/* Makes room in the run cache for rows `[0, height)`, as far as memory
+ * allows. */
+static void
+frame__runs_reserve(s32 height)
+{
+#if FRAME_RUN_CACHE
+	if (height <= g_num_runs) {
+		return;
+	}
+
+	struct frame__run *runs = realloc(g_runs, height * sizeof(*runs));
+	if (!runs) {
+		return;
+	}
+	memset(runs + g_num_runs, 0, (height - g_num_runs) * sizeof(*runs));
+	g_runs = runs;
+	g_num_runs = height;
+#else
+	UNUSED(height);
+#endif
+}
+
+/* Whether two rasters would encode the same cells to the same bytes. */
+static inline bool
+frame__raster_state_eq(struct frame__raster const *a, struct frame__raster const *b)
+{
+	return 
+		a->prior_x == b->prior_x &&
+		a->prior_y == b->prior_y &&
+		a->prior_fg == b->prior_fg &&
+		a->prior_bg == b->prior_bg &&
+		a->sgr_known == b->sgr_known &&
+		a->caps == b->caps &&
+		a->term_w == b->term_w;
+}
+
+/**
+ * Like `frame__raster_row`, but a row repainted (without a `front` row
+ * or over a blank one, with no budget) just as before is copied from
+ * the run cache rather than encoded again. Any cell that looks
+ * different, or a different raster state, makes it encode the row anew
+ * and keep that instead.
+ */
+static void
+frame__raster_row_cached(
+	struct frame__raster *raster,
+	struct cell const *row,
+	struct cell *front,
+	s32 count,
+	s32 dst_x,
+	s32 dst_y,
+	u8 *scratch
+) {
+#if FRAME_RUN_CACHE
+	if (!raster->cached ||
+	    (front && !raster->front_blank) ||
+	    raster->budget != UINT32_MAX ||
+	    dst_y < 0 || dst_y >= g_num_runs)
+	{
+		frame__raster_row(raster, row, front, count, dst_x, dst_y, scratch);
+		return;
+	}
+
+	struct frame__run *run = &g_runs[dst_y];
+	if (run->num_cells == count &&
+	    run->dst_x == dst_x &&
+	    run->diffed == (front != NULL) &&
+	    frame__raster_state_eq(&run->entry, raster))
+	{
+		s32 i = 0;
+		while (i < count && frame__cell_seen_eq(&row[i], &run->cells[i])) {
+			++i;
+		}
+
+		if (i == count) {
+			raster->throughput += t_write(run->bytes, run->size);
+			raster->prior_x = run->exit.prior_x;
+			raster->prior_y = run->exit.prior_y;
+			raster->prior_fg = run->exit.prior_fg;
+			raster->prior_bg = run->exit.prior_bg;
+			raster->sgr_known = run->exit.sgr_known;
+
+			/* as diffing against the blank row would have left it */
+			for (i = 0; front && i < count; ++i) {
+				if (row[i].content) {
+					front[i] = frame__cell_shown(&row[i]);
+				}
+			}
+			return;
+		}
+	}
+
+	struct frame__raster const entry = *raster;
+	struct t_write_mark const mark = t_write_mark();
+	frame__raster_row(raster, row, front, count, dst_x, dst_y, scratch);
+
+	run->num_cells = 0;
+
+	u32 size;
+	u8 const *bytes = t_written_since(mark, &size);
+	if (!bytes) {
+		return;
+	}
+
+	if ((u32) count > run->cells_capacity) {
+		struct cell *cells = realloc(run->cells, count * sizeof(*cells));
+		if (!cells) {
+			return;
+		}
+		run->cells = cells;
+		run->cells_capacity = count;
+	}
+	if (size > run->bytes_capacity) {
+		u8 *copy = realloc(run->bytes, size);
+		if (!copy) {
+			return;
+		}
+		run->bytes = copy;
+		run->bytes_capacity = size;
+	}
+
+	memcpy(run->cells, row, count * sizeof(*row));
+	memcpy(run->bytes, bytes, size);
+	run->num_cells = count;
+	run->dst_x = dst_x;
+	run->diffed = front != NULL;
+	run->entry = entry;
+	run->size = size;
+	run->exit = *raster;
+#else
+	frame__raster_row(raster, row, front, count, dst_x, dst_y, scratch);
+#endif
+}
+
+/* Rasterizes the rows `[y0, y1)` of `dstbox` (in terminal coordinates),
+ * diffing against `front` unless NULL, with `srcbox` the matching part
+ * of `frame`. */
+static void
+frame__raster_rows(
+	struct frame__raster *raster,
+	struct frame *frame,
+	struct frame *front,
+	struct box const *dstbox,
+	struct box const *srcbox,
+	s32 y0,
+	s32 y1,
+	u8 *scratch
+);
+
+/* @SECTION(bands) */
+/* @TUNABLE FRAME_THREADS_MAX (threads encoding bands of rows in parallel,
+ * see `frame_raster_threads`) */
+#ifndef FRAME_THREADS_MAX
+#  define FRAME_THREADS_MAX 16
+#endif
+
+/* @TUNABLE FRAME_BANDS_MIN_CELLS (boxes with fewer cells are encoded by
+ * the calling thread alone, not being worth the handoff) */
+#ifndef FRAME_BANDS_MIN_CELLS
+#  define FRAME_BANDS_MIN_CELLS 16384
+#endif
+
+/* Rows encoded on a thread of its own, into its own capture. */
+struct frame__band
+{
+	struct frame       *frame;
+	struct frame       *front;
+	struct box          dstbox;
+	struct box          srcbox;
+	s32                 y0, y1;
+	s32                 term_w;
+	bool                front_blank;
+
+	/* the encoding, NULL if it couldn't be captured */
+	u8 const           *data;
+	u32                 size;
+	u32                 throughput;
+	bool                diffed; /* into `front`, captured or not */
+};
+
+/* @GLOBAL */
+static pthread_t              g_band_threads [FRAME_THREADS_MAX];
+static struct frame__band     g_bands        [FRAME_THREADS_MAX];
+static u32                    g_num_threads  = 1; /* including the caller */
+static pthread_mutex_t        g_band_lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t         g_band_wake    = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t         g_band_done    = PTHREAD_COND_INITIALIZER;
+static u64                    g_band_generation;
+static u32                    g_bands_pending;
+static bool                   g_bands_running;
+
+/* the captures are spliced into the output, so they can't be reused
+ * before it went past them (see `t_splice`) */
+static u64                    g_bands_position;
+
+static void *
+frame__band_main(void *opaque)
+{
+	struct frame__band *band = opaque;
+	u64 generation = 0;
+
+	/* never a writer of the shared output */
+	t_capture_thread();
+
+	pthread_mutex_lock(&g_band_lock);
+	for (;;) {
+		while (g_band_generation == generation && g_bands_running) {
+			pthread_cond_wait(&g_band_wake, &g_band_lock);
+		}
+		if (!g_bands_running) {
+			break;
+		}
+		generation = g_band_generation;
+		pthread_mutex_unlock(&g_band_lock);
+
+		band->data = NULL;
+		band->size = 0;
+		band->throughput = 0;
+		band->diffed = false;
+
+		if (t_capture_begin()) {
+			/* starts with an absolute move and a reset, like any
+			 * raster that knows nothing of the terminal state */
+			struct frame__raster raster;
+			frame__raster_init(&raster, band->term_w);
+			raster.front_blank = band->front_blank;
+
+			u8 scratch [BOX_WIDTH(&band->dstbox) + 1];
+			frame__raster_rows(&raster, band->frame, band->front,
+				&band->dstbox, &band->srcbox, band->y0, band->y1, scratch
+			);
+
+			band->data = t_capture_end(&band->size);
+			band->throughput = raster.throughput;
+			band->diffed = band->front != NULL;
+		}
+
+		pthread_mutex_lock(&g_band_lock);
+		if (--g_bands_pending == 0) {
+			pthread_cond_signal(&g_band_done);
+		}
+	}
+	pthread_mutex_unlock(&g_band_lock);
+
+	/* the capture of this thread goes with it, the output went past it
+	 * (see `frame__bands_stop`) */
+	if (t_capturing()) {
+		u32 size;
+		t_capture_end(&size);
+	}
+	t_capture_free();
+	return NULL;
+}
+
+static void
+frame__bands_stop()
+{
+	/* the threads free their captures, which the output may still be
+	 * about to write */
+	if (t_released() < g_bands_position) {
+		t_drain();
+	}
+
+	pthread_mutex_lock(&g_band_lock);
+	g_bands_running = false;
+	pthread_cond_broadcast(&g_band_wake);
+	pthread_mutex_unlock(&g_band_lock);
+
+	for (u32 i = 1; i < g_num_threads; ++i) {
+		pthread_join(g_band_threads[i], NULL);
+	}
+	g_num_threads = 1;
+}
+
+bool
+frame_raster_threads(u32 count)
+{
+	count = MIN(MAX(count, 1), FRAME_THREADS_MAX);
+	if (count == g_num_threads) {
+		return true;
+	}
+	frame__bands_stop();
+
+	if (count == 1) {
+		return true;
+	}
+
+	/* the threads take on the generations after the one they start in */
+	g_band_generation = 0;
+	g_bands_running = true;
+	for (u32 i = 1; i < count; ++i) {
+		if (pthread_create(&g_band_threads[i], NULL, frame__band_main, &g_bands[i]) != 0) {
+			/* go on with the threads there are */
+			break;
+		}
+		g_num_threads = i + 1;
+	}
+	if (g_num_threads == 1) {
+		g_bands_running = false;
+	}
+	return g_num_threads == count;
+}
+
+/* Like `frame__raster_rows` over all of `dstbox`, in bands of rows on
+ * all threads if that's worth it, the first on the calling thread and
+ * the others spliced after it in order. */
+static void
+frame__raster_bands(
+	struct frame__raster *raster,
+	struct frame *frame,
+	struct frame *front,
+	struct box const *dstbox,
+	struct box const *srcbox,
+	u8 *scratch
+) {
+	s32 const height = BOX_HEIGHT(dstbox);
+	u32 const count = MIN(g_num_threads, (u32) MAX(height, 1));
+
+	if (count < 2 || 
+	    BOX_WIDTH(dstbox) * height < FRAME_BANDS_MIN_CELLS ||
+	    raster->budget != UINT32_MAX ||
+	    t_released() < g_bands_position)
+	{
+		frame__raster_rows(raster, frame, front, dstbox, srcbox, 
+			dstbox->y0, dstbox->y1, scratch
+		);
+		return;
+	}
+
+	pthread_mutex_lock(&g_band_lock);
+	for (u32 i = 1; i < g_num_threads; ++i) {
+		/* threads beyond `count` get an empty band */
+		g_bands[i] = (struct frame__band) {
+			.frame  = frame,
+			.front  = front,
+			.dstbox = *dstbox,
+			.srcbox = *srcbox,
+			.y0     = dstbox->y0 + height * MIN(i, count) / count,
+			.y1     = dstbox->y0 + height * MIN(i + 1, count) / count,
+			.term_w = raster->term_w,
+			.front_blank = raster->front_blank,
+		};
+	}
+	g_bands_pending = g_num_threads - 1;
+	++g_band_generation;
+	pthread_cond_broadcast(&g_band_wake);
+	pthread_mutex_unlock(&g_band_lock);
+
+	frame__raster_rows(raster, frame, front, dstbox, srcbox,
+		dstbox->y0, dstbox->y0 + height / count, scratch
+	);
+
+	pthread_mutex_lock(&g_band_lock);
+	while (g_bands_pending) {
+		pthread_cond_wait(&g_band_done, &g_band_lock);
+	}
+	pthread_mutex_unlock(&g_band_lock);
+
+	for (u32 i = 1; i < count; ++i) {
+		struct frame__band const *band = &g_bands[i];
+
+		/* what the terminal is left with is up to the band before */
+		raster->prior_x = INT16_MIN;
+		raster->prior_y = INT16_MIN;
+		raster->sgr_known = false;
+
+		/* a band that couldn't be captured is encoded here instead,
+		 * in full if its part of the front buffer is up to date already
+		 * while the terminal missed some of it */
+		if (!band->data) {
+			frame__raster_rows(raster, frame, band->diffed ? NULL : front, 
+				dstbox, srcbox, band->y0, band->y1, scratch
+			);
+			continue;
+		}
+		if (band->size) {
+			u64 const position = t_splice(band->data, band->size);
+			g_bands_position = MAX(g_bands_position, position);
+		}
+		raster->throughput += band->throughput;
+	}
+
+	raster->prior_x = INT16_MIN;
+	raster->prior_y = INT16_MIN;
+	raster->sgr_known = false;
+}
+
 u32
 frame_rasterize(struct frame *frame, s32 x, s32 y)
 {
@@ -454,84 +1397,318 @@ frame_rasterize(struct frame *frame, s32 x, s32 y)
 		x, y
 	);
 
-	/* How much was actually written out to the terminal in bytes, we're
-	 * mostly interested if this remains 0. @TODO maybe make this part 
-	 * of the actual terminal interface because keeping track of these 
-	 * additions is annoying. */
-	u32 throughput = 0;
+	struct frame__raster raster;
+	frame__raster_init(&raster, term_w);
+	frame__runs_reserve(term_h);
 
-	/* any constants less than -1 required for init position to
-	 * push through initial positions onto the terminal */
-	s32 prior_x = INT16_MIN;
-	s32 prior_y = INT16_MIN;
+	u8 scratch [BOX_WIDTH(&dstbox) + 1];
 
-	u8 prior_fg = 0;
-	u8 prior_bg = 0;
-	throughput += t_reset();
+	frame__raster_bands(&raster, frame, NULL, &dstbox, &srcbox, scratch);
+	return raster.throughput;
+}
 
-	for (s32 j = 0; j < BOX_HEIGHT(&dstbox); ++j) {
-		for (s32 i = 0; i < BOX_WIDTH(&dstbox); ++i) {
-			s32 const
-				src_x = srcbox.x0 + i,
-				src_y = srcbox.y0 + j;
+void
+frame_rasterize_sinks()
+{
+	s32 sink, last = -1;
+	while ((sink = t_sink_resync_wanted()) >= 0 && sink != last) {
+		/* one still wanting it right after was out of memory, it is 
+		 * tried again with the next frame */
+		last = sink;
+
+		/* the next diff starts over with a clear screen anyway */
+		if (g_front_stale) {
+			t_sink_resync(sink, NULL, 0);
+			continue;
+		}
 
-			struct cell *cell = frame_cell_at(frame, src_x, src_y);
-			if (!cell->content) {
-				continue;
-			}
+		/* the repaint must not end up in the output, the sink keeps
+		 * wanting it until the next frame */
+		if (!t_capture_begin()) {
+			break;
+		}
 
-			int32_t const
-				dst_x = dstbox.x0 + i,
-				dst_y = dstbox.y0 + j;
-
-			/* CURSOR POS */
-			s32 delta_x = dst_x - prior_x;
-			s32 delta_y = dst_y - prior_y;
-
-			/* @SPEED(max): take a look into this a bit more */
-			/* @NOTE(max): converting delta_y into \v chars does NOT
-			 * improve throughput significantly.
-			 */
-			/* minimaly optimize byte usage for relocation */
-			if (delta_x && delta_y) {
-				t_cursor_pos(dst_x + 1, dst_y + 1);
-			}
-			else if (delta_x > 0) {
-				t_cursor_forward(delta_x);
-			}
-			else if (delta_x < 0) {
-				t_cursor_back(-delta_x);
-			}
-			else if (delta_y > 0) {
-				t_cursor_down(delta_y);
-			}
-			else if (delta_y < 0) {
-				t_cursor_up(delta_y);
-			}
-			prior_x = dst_x + 1; /* to account for cursor advancing right when writing */
-			prior_y = dst_y;
-			
-			/* COLOR */
-			if (cell->foreground != prior_fg || 
-			    cell->background != prior_bg)
-			{
-				if (!cell->foreground || cell->background) {
-					throughput += t_reset();
-					prior_fg = 0;
-					prior_bg = 0;
-				}
-				if (cell->foreground != prior_fg) {
-					prior_fg = cell->foreground;
-					t_foreground_256(cell->foreground);
-				}
-				if (cell->background != prior_bg) {
-					prior_bg = cell->background;
-					t_background_256(cell->background);
-				}
-			}
+		struct frame__raster raster;
+		frame__raster_init(&raster, g_front.width);
+		raster.cached = false;
 
-			throughput += t_writec(cell->content);
+		/* which also ends a synchronized update or scroll margins the
+		 * sink was left in */
+		bool const synced = raster.caps & T_CAP_SYNC;
+		if (synced) {
+			t_sync_begin();
+		}
+		t_scroll_region_reset();
+		frame__raster_color(&raster, 0, 0);
+		t_clear();
+
+		u8 scratch [g_front.width + 1];
+		for (s32 j = 0; j < g_front.height; ++j) {
+			frame__raster_row_cached(&raster,
+				frame_cell_at(&g_front, 0, j),
+				NULL,
+				g_front.width,
+				0, j,
+				scratch
+			);
 		}
+		if (synced) {
+			t_sync_end();
+		}
+
+		u32 size;
+		u8 const *repaint = t_capture_end(&size);
+		if (!repaint) {
+			break;
+		}
+		t_sink_resync(sink, repaint, size);
+	}
+}
+
+void
+frame_rasterize_invalidate()
+{
+	g_front_stale = true;
+}
+
+u32
+frame_rasterize_diff(struct frame *frame, s32 x, s32 y)
+{
+	return frame_rasterize_diff_budgeted(frame, x, y, UINT32_MAX, NULL, 0);
+}
+
+/* Has the terminal scroll along with a frame scrolled at (x, y) on the
+ * terminal, and the front buffer along with it. Only boxes spanning 
+ * whole terminal rows can be scrolled through the margins. */
+static void
+frame__raster_scroll(
+	struct frame__raster *raster,
+	struct frame_scroll const *scroll,
+	s32 x,
+	s32 y,
+	s32 term_h
+) {
+	struct box moved, area;
+	box_translate(&moved, &scroll->box, x, y);
+	box_intersect(&area, &BOX_SCREEN(raster->term_w, term_h), &moved);
+
+	s32 const shift = ABS(scroll->dy);
+	if (area.x0 > 0 || area.x1 < raster->term_w || 
+	    shift == 0 || shift >= area.y1 - area.y0) 
+	{
+		return;
+	}
+
+	/* the rows scrolled into view get the current background */
+	frame__raster_color(raster, 0, 0);
+
+	bool const margins = area.y0 > 0 || area.y1 < term_h;
+	if (margins) {
+		raster->throughput += t_scroll_region(area.y0 + 1, area.y1);
+	}
+	raster->throughput += scroll->dy < 0 ? 
+		t_scroll_up(shift) : t_scroll_down(shift);
+	if (margins) {
+		/* which also homes the cursor */
+		raster->throughput += t_scroll_region_reset();
+		raster->prior_x = 0;
+		raster->prior_y = 0;
+	}
+
+	frame_scroll(&g_front, &area, scroll->dy);
+	g_front.num_scrolls = 0;
+}
+
+/* Diffs the rows `[y0, y1)` of `box` (in terminal coordinates) within
+ * the destination box against `front`, with `srcbox` the matching part
+ * of `frame`. Returns the row the budget ran out on, or INT32_MAX. */
+static s32
+frame__raster_diff_rows(
+	struct frame__raster *raster,
+	struct frame *frame,
+	struct frame *front,
+	struct box const *dstbox,
+	struct box const *srcbox,
+	struct box const *box,
+	s32 y0,
+	s32 y1,
+	u8 *scratch
+) {
+	s32 const x0 = MAX(box->x0, dstbox->x0);
+	s32 const x1 = MIN(box->x1, dstbox->x1);
+	if (x0 >= x1) {
+		return INT32_MAX;
+	}
+
+	y0 = MAX(y0, MAX(box->y0, dstbox->y0));
+	y1 = MIN(y1, MIN(box->y1, dstbox->y1));
+
+	for (s32 dst_y = y0; dst_y < y1; ++dst_y) {
+		if (raster->throughput >= raster->budget) {
+			return dst_y;
+		}
+		frame__raster_row_cached(raster,
+			frame_cell_at(frame, 
+				srcbox->x0 + x0 - dstbox->x0, 
+				srcbox->y0 + dst_y - dstbox->y0
+			),
+			frame_cell_at(front, x0, dst_y),
+			x1 - x0,
+			x0, dst_y,
+			scratch
+		);
+	}
+	return INT32_MAX;
+}
+
+static void
+frame__raster_rows(
+	struct frame__raster *raster,
+	struct frame *frame,
+	struct frame *front,
+	struct box const *dstbox,
+	struct box const *srcbox,
+	s32 y0,
+	s32 y1,
+	u8 *scratch
+) {
+	if (front) {
+		frame__raster_diff_rows(raster, frame, front, dstbox, srcbox,
+			dstbox, y0, y1, scratch
+		);
+		return;
 	}
-	return throughput;
+
+	for (s32 dst_y = y0; dst_y < y1; ++dst_y) {
+		frame__raster_row_cached(raster,
+			frame_cell_at(frame, srcbox->x0, srcbox->y0 + dst_y - dstbox->y0),
+			NULL,
+			BOX_WIDTH(dstbox),
+			dstbox->x0, dst_y,
+			scratch
+		);
+	}
+}
+
+u32
+frame_rasterize_diff_budgeted(
+	struct frame *frame, 
+	s32 x, 
+	s32 y, 
+	u32 budget,
+	struct box const *priority,
+	s32 num_priority
+) {
+	s32 term_w, term_h;
+	t_query_size(&term_w, &term_h);
+
+	struct frame__raster raster;
+	frame__raster_init(&raster, term_w);
+
+	/* start over from a blank screen whenever we can't trust what the
+	 * terminal is showing (first use, resize, explicit invalidation) */
+	if (g_front_stale || 
+	    g_front.width != term_w || 
+	    g_front.height != term_h)
+	{
+		if (!frame_realloc(&g_front, term_w, term_h)) {
+			/* @TODO log inconvenience */
+			return raster.throughput;
+		}
+		frame_zero_grid(&g_front);
+
+		/* erasing paints the current background on most terminals */
+		frame__raster_color(&raster, 0, 0);
+		raster.throughput += t_clear();
+		raster.front_blank = true;
+		g_front_stale = false;
+
+		/* nothing to scroll on a blank screen */
+		frame->num_scrolls = 0;
+	}
+
+	frame__runs_reserve(term_h);
+	for (u32 i = 0; i < frame->num_scrolls; ++i) {
+		frame__raster_scroll(&raster, &frame->scrolls[i], x, y, term_h);
+	}
+	frame->num_scrolls = 0;
+
+	struct box box;
+	frame_compute_clip_box(&box, frame);
+
+	struct box dstbox, srcbox;
+	box_intersect_with_offset(
+		&dstbox, &srcbox,
+		&BOX_SCREEN(term_w, term_h),
+		&box,
+		x, y
+	);
+
+	u8 scratch [BOX_WIDTH(&dstbox) + 1];
+
+	/* the clear above is never held back, the budget only applies to
+	 * the changes on top of it */
+	raster.budget = budget > UINT32_MAX - raster.throughput ? 
+		UINT32_MAX : raster.throughput + budget;
+
+	/* with no budget, the order doesn't matter */
+	if (budget == UINT32_MAX) {
+		frame__raster_bands(&raster, frame, &g_front, &dstbox, &srcbox, scratch);
+		g_budget_row = INT32_MIN;
+		return raster.throughput;
+	}
+
+	for (s32 i = 0; i < num_priority; ++i) {
+		frame__raster_diff_rows(&raster, frame, &g_front, &dstbox, &srcbox,
+			&priority[i], INT32_MIN, INT32_MAX, scratch
+		);
+	}
+
+	/* then the rest, carrying on from where the last frame ran out so 
+	 * the rows at the bottom get their turn (cells sent already match
+	 * the front buffer by now and are skipped) */
+	s32 stop = frame__raster_diff_rows(&raster, frame, &g_front, &dstbox, &srcbox,
+		&dstbox, g_budget_row, INT32_MAX, scratch
+	);
+	if (stop == INT32_MAX) {
+		stop = frame__raster_diff_rows(&raster, frame, &g_front, &dstbox, &srcbox,
+			&dstbox, INT32_MIN, g_budget_row, scratch
+		);
+	}
+	g_budget_row = stop == INT32_MAX ? INT32_MIN : stop;
+	return raster.throughput;
+}
+
+u32
+frame_rasterize_delta(struct frame *frame, struct frame *front, u32 caps)
+{
+	struct frame__raster raster;
+	frame__raster_init(&raster, frame->width);
+	raster.caps = caps;
+	raster.cached = false;
+
+	if (!front->grid || 
+	    front->width != frame->width || 
+	    front->height != frame->height)
+	{
+		if (!frame_realloc(front, frame->width, frame->height)) {
+			/* @TODO log inconvenience */
+			return raster.throughput;
+		}
+		frame_zero_grid(front);
+
+		frame__raster_color(&raster, 0, 0);
+		raster.throughput += t_clear();
+		raster.front_blank = true;
+	}
+
+	struct box box;
+	frame_compute_clip_box(&box, frame);
+
+	u8 scratch [BOX_WIDTH(&box) + 1];
+
+	frame__raster_diff_rows(&raster, frame, front, &box, &box,
+		&box, INT32_MIN, INT32_MAX, scratch
+	);
+	return raster.throughput;
 }
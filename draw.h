@@ -4,8 +4,20 @@
 #include <string.h>
 
 #include "geometry.h"
+#include "terminal.h"
 
 
+/* @TUNABLE CELL_TRUECOLOR
+ * Cells carry 24-bit colors (see `T_COLOR_RGB`) instead of 256 color
+ * codes, at the cost of 12 rather than 4 bytes per cell. 256 color codes
+ * remain usable as colors in this mode.
+ */
+#ifdef CELL_TRUECOLOR
+typedef u32 cell_color;
+#else
+typedef u8  cell_color;
+#endif
+
 /* @SECTION(color) */
 static inline u8
 rgb256(s32 r, s32 g, s32 b)
@@ -28,6 +40,39 @@ gray256(s32 scale)
 	return 232 + (index % 24) - (index / 24);
 }
 
+/* Exact colors when `CELL_TRUECOLOR`, their 256 color approximations
+ * otherwise. */
+static inline cell_color
+cell_rgb(s32 r, s32 g, s32 b)
+{
+#ifdef CELL_TRUECOLOR
+	return T_COLOR_RGB(r, g, b);
+#else
+	return rgb256(r, g, b);
+#endif
+}
+
+static inline cell_color
+cell_gray(s32 scale)
+{
+#ifdef CELL_TRUECOLOR
+	return T_COLOR_RGB(scale, scale, scale);
+#else
+	return gray256(scale);
+#endif
+}
+
+/* Folds a color into a byte which is zero only if the color is. */
+static inline u8
+cell_color_fold(cell_color color)
+{
+#ifdef CELL_TRUECOLOR
+	return (color | (color >> 8) | (color >> 16) | (color >> 24)) & 0xff;
+#else
+	return color;
+#endif
+}
+
 /* @SECTION(cell) */
 #define CELL_FOREGROUND_BIT 0x01
 #define CELL_BACKGROUND_BIT 0x02
@@ -36,24 +81,24 @@ gray256(s32 scale)
 
 struct cell
 {
-	u8 foreground;
-	u8 background;
-	s8 content;
-	s8 stencil;
+	cell_color foreground;
+	cell_color background;
+	s8         content;
+	s8         stencil;
 };
 #define CELL_FOREGROUND(foreground_) \
 	((struct cell){.foreground = foreground_,})
 #define CELL_FOREGROUND_RGB(fr_, fg_, fb_) \
-	((struct cell){.foreground = rgb256(fr_, fg_, fb_),})
+	((struct cell){.foreground = cell_rgb(fr_, fg_, fb_),})
 #define CELL_FOREGROUND_GRAY(scale_) \
-	((struct cell){.foreground = gray256(scale_),})
+	((struct cell){.foreground = cell_gray(scale_),})
 
 #define CELL_BACKGROUND(background_) \
 	((struct cell){.background = background_,})
 #define CELL_BACKGROUND_RGB(fr_, fg_, fb_) \
-	((struct cell){.background = rgb256(fr_, fg_, fb_),})
+	((struct cell){.background = cell_rgb(fr_, fg_, fb_),})
 #define CELL_BACKGROUND_GRAY(scale_) \
-	((struct cell){.background = gray256(scale_),})
+	((struct cell){.background = cell_gray(scale_),})
 
 #define CELL_CONTENT(content_) \
 	((struct cell){.content = content_,})
@@ -67,17 +112,17 @@ struct cell
 
 struct cell_mask
 {
-	u8 foreground;
-	u8 background;
-	u8 content;
-	u8 stencil;
+	cell_color foreground;
+	cell_color background;
+	u8         content;
+	u8         stencil;
 };
 
 static inline struct cell_mask *
 cell_mask_from_bits(struct cell_mask *dst, u8 mask)
 {
-	dst->foreground = mask & CELL_FOREGROUND_BIT ? 0xff : 0;
-	dst->background = mask & CELL_BACKGROUND_BIT ? 0xff : 0;
+	dst->foreground = mask & CELL_FOREGROUND_BIT ? (cell_color) ~0 : 0;
+	dst->background = mask & CELL_BACKGROUND_BIT ? (cell_color) ~0 : 0;
 	dst->content    = mask & CELL_CONTENT_BIT    ? 0xff : 0;
 	dst->stencil    = mask & CELL_STENCIL_BIT    ? 0xff : 0;
 	return dst;
@@ -89,8 +134,9 @@ cell_mask_broadcast_and(
 	struct cell_mask const *src, 
 	u8 mask
 ) {
-	dst->foreground = mask & src->foreground;
-	dst->background = mask & src->background;
+	cell_color const wide_mask = mask ? (cell_color) ~0 : 0;
+	dst->foreground = wide_mask & src->foreground;
+	dst->background = wide_mask & src->background;
 	dst->content    = mask & src->content;
 	dst->stencil    = mask & src->stencil;
 	return dst;
@@ -111,12 +157,24 @@ cell_mask_apply_binary(
 }
 
 /* @SECTION(frame) */
+/* @TUNABLE FRAME_SCROLLS_MAX (scrolls a frame remembers between two
+ * rasterizations, see `frame_scroll`) */
+#ifndef FRAME_SCROLLS_MAX
+#  define FRAME_SCROLLS_MAX 4
+#endif
+
 struct clip 
 {
 	s32 tlx, tly; /* top left (x, y) offsets */
 	s32 brx, bry; /* bottom right (x, y) offsets */
 };
 
+struct frame_scroll
+{
+	struct box    box;
+	s32           dy;
+};
+
 struct frame
 {
 	struct cell  *grid;
@@ -125,6 +183,10 @@ struct frame
 
 	struct clip   clip;
 
+	/* see `frame_scroll`, consumed by `frame_rasterize_diff` */
+	struct frame_scroll scrolls [FRAME_SCROLLS_MAX];
+	u32                 num_scrolls;
+
 	/* if used with frame_realloc, client shouldn't touch, otherwise,
 	 * this is here for client code to manage their memory and give
 	 * hints to library routines about grid allocation (for ex.
@@ -334,6 +396,26 @@ frame_resize(struct frame *frame, s32 width, s32 height);
 u32
 frame_load_pattern(struct frame *frame, s32 x, s32 y, char const *pattern);
 
+/**
+ * Shifts the rows of the given box by `dy` (down if positive, up if
+ * negative), leaving the rows that scroll into view empty. 
+ *
+ * The scroll is also remembered until the next `frame_rasterize_diff`,
+ * which has the terminal scroll its own contents (DECSTBM with SU/SD)
+ * when the box spans the terminal's whole width, so that only the rows
+ * that scrolled into view (and whatever else changed) are sent.
+ *
+ * This routine DOES NOT adhere to the `clip` setting.
+ *
+ * @param frame The frame to scroll.
+ * @param box The box to scroll within (in frame coordinates).
+ * @param dy The number of rows to scroll by.
+ *
+ * @return The frame.
+ */
+struct frame *
+frame_scroll(struct frame *frame, struct box const *box, s32 dy);
+
 /* @SECTION(frame_draw) */
 /**
  * Analogous to assembly CMP instruction, that is, performs a subtraction
@@ -443,4 +525,102 @@ frame_typeset_flrr(struct frame *dst, struct box *out_bb, s32 x, s32 y, s32 widt
 u32
 frame_rasterize(struct frame *frame, s32 x, s32 y);
 
+/**
+ * Has `frame_rasterize` and the unbudgeted `frame_rasterize_diff` split
+ * large boxes into bands of rows encoded in parallel, each starting
+ * with an absolute move and a reset, and put out in order without being
+ * copied. The calling thread encodes the first band. While the output
+ * still refers to the bands of the last frame (see `t_splice`), for ex.
+ * when `T_OUTPUT_THREADED` is behind, frames are encoded on the calling
+ * thread alone. Changing the count drains the output (see `t_drain`) so
+ * the threads can free their bands, and is not meant for within a frame.
+ *
+ * @param count The number of threads to encode with, including the 
+ *     calling one, up to FRAME_THREADS_MAX (1 to stop the others).
+ *
+ * @return Whether as many threads could be started.
+ */
+bool
+frame_raster_threads(u32 count);
+
+/**
+ * Like `frame_rasterize`, but only emits the cells that differ from what
+ * the master terminal is believed to show (the "front buffer", which is
+ * retained across calls). Cells of the frame without content are wiped
+ * if they were previously drawn over. The whole terminal is cleared
+ * first on the initial call, after a resize, or after
+ * `frame_rasterize_invalidate`.
+ *
+ * @param frame The frame to rasterize.
+ * @param x The desired column on the master terminal.
+ * @param y The desired row on the master terminal.
+ *
+ * @return The number of bytes written to the terminal.
+ */
+u32
+frame_rasterize_diff(struct frame *frame, s32 x, s32 y);
+
+/**
+ * Like `frame_rasterize_diff`, but stops once about `budget` bytes of
+ * changes were written, leaving the rest for the following calls. The 
+ * changed cells inside the `priority` boxes (in terminal coordinates) 
+ * are emitted first, in order, then the remaining ones starting from 
+ * the row the previous call ran out on, so that every change reaches
+ * the terminal eventually while the output per frame stays bounded.
+ *
+ * @param frame The frame to rasterize.
+ * @param x The desired column on the master terminal.
+ * @param y The desired row on the master terminal.
+ * @param budget The number of bytes to stop after (the last span may
+ *     overshoot it, and a full clear is never held back).
+ * @param priority Optional boxes to emit first.
+ * @param num_priority The number of `priority` boxes.
+ *
+ * @return The number of bytes written to the terminal.
+ */
+u32
+frame_rasterize_diff_budgeted(
+	struct frame *frame, 
+	s32 x, 
+	s32 y, 
+	u32 budget,
+	struct box const *priority,
+	s32 num_priority
+);
+
+/**
+ * Like `frame_rasterize_diff`, but against the given front buffer rather 
+ * than the master terminal's, and for a screen the size of the frame 
+ * (with the frame's top left corner at the top left of the screen). A
+ * front buffer of another size (for ex. a zeroed frame struct) starts 
+ * over from a cleared screen. Best used within a `t_capture_begin` 
+ * capture, to encode the frame for some other screen.
+ *
+ * @param frame The frame to rasterize.
+ * @param front What the screen is believed to show, updated to match
+ *     the frame.
+ * @param caps The `enum t_capability` flags of the screen.
+ *
+ * @return The number of bytes written.
+ */
+u32
+frame_rasterize_delta(struct frame *frame, struct frame *front, u32 caps);
+
+/**
+ * Repaints the front buffer (see `frame_rasterize_diff`) for each sink
+ * that lost track of the output (see `t_sink_resync_wanted`), encoding
+ * it separately for each. Call this right after a frame is flushed.
+ */
+void
+frame_rasterize_sinks();
+
+/**
+ * Forgets the front buffer so the next `frame_rasterize_diff` repaints
+ * the whole terminal. Call this whenever something other than
+ * `frame_rasterize_diff` writes to the terminal (ex. `t_clear` or
+ * `frame_rasterize`).
+ */
+void
+frame_rasterize_invalidate();
+
 #endif /* INCLUDE__DRAW_H */
@@ -0,0 +1,326 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "app.h"
+#include "terminal.h"
+#include "spectate.h"
+
+/* @TUNABLE SPECTATE_CLIENTS_MAX */
+#ifndef SPECTATE_CLIENTS_MAX
+#  define SPECTATE_CLIENTS_MAX 8
+#endif
+
+#define SPECTATE__LISTENER UINT32_MAX
+
+struct spectate__client
+{
+	s32           fd; /* -1 if the slot is free */
+
+	/* what the client shows once `pending` is sent */
+	struct frame  front;
+
+	u8           *pending;
+	u32           pending_size;
+	u32           pending_sent;
+	u32           pending_capacity;
+};
+
+/* @GLOBAL */
+static s32                     g_listen_fd = -1;
+static s32                     g_epoll_fd  = -1;
+static struct sockaddr_un      g_address;
+static u32                     g_caps;
+
+static struct spectate__client g_clients [SPECTATE_CLIENTS_MAX];
+static u32                     g_num_clients;
+
+static void
+spectate__drop(struct spectate__client *client)
+{
+	epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+	frame_free(&client->front);
+	free(client->pending);
+
+	*client = (struct spectate__client) { .fd = -1 };
+	--g_num_clients;
+
+	app_log_info("Spectator %u left.", (unsigned) (client - g_clients));
+}
+
+/* Sends as much pending output as the client takes, asking to be told
+ * when it takes more if there is any left. */
+static void
+spectate__send(struct spectate__client *client)
+{
+	while (client->pending_sent < client->pending_size) {
+		ssize_t const sent = send(client->fd,
+			client->pending + client->pending_sent,
+			client->pending_size - client->pending_sent,
+			MSG_DONTWAIT | MSG_NOSIGNAL
+		);
+
+		if (sent >= 0) {
+			client->pending_sent += sent;
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			break;
+		}
+		else if (errno != EINTR) {
+			spectate__drop(client);
+			return;
+		}
+	}
+
+	bool const done = client->pending_sent == client->pending_size;
+	if (done) {
+		client->pending_size = 0;
+		client->pending_sent = 0;
+	}
+
+	struct epoll_event event = {
+		.events = EPOLLIN | EPOLLRDHUP | (done ? 0 : EPOLLOUT),
+		.data.u32 = client - g_clients,
+	};
+	epoll_ctl(g_epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+}
+
+static void
+spectate__accept()
+{
+	for (;;) {
+		s32 const fd = accept(g_listen_fd, NULL, NULL);
+		if (fd < 0) {
+			return;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+		struct spectate__client *client = NULL;
+		for (u32 i = 0; i < SPECTATE_CLIENTS_MAX; ++i) {
+			if (g_clients[i].fd < 0) {
+				client = &g_clients[i];
+				break;
+			}
+		}
+
+		if (!client) {
+			app_log_warn("Turned a spectator away, no room left.");
+			close(fd);
+			continue;
+		}
+
+		struct epoll_event event = {
+			.events = EPOLLIN | EPOLLRDHUP,
+			.data.u32 = client - g_clients,
+		};
+		if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			close(fd);
+			continue;
+		}
+
+		/* a zeroed front buffer gets a full frame first */
+		*client = (struct spectate__client) { .fd = fd };
+		++g_num_clients;
+
+		app_log_info("Spectator %u joined.", (unsigned) (client - g_clients));
+	}
+}
+
+bool
+spectate_start(char const *path, u32 caps)
+{
+	for (u32 i = 0; i < SPECTATE_CLIENTS_MAX; ++i) {
+		g_clients[i].fd = -1;
+	}
+	g_caps = caps;
+
+	g_address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(g_address.sun_path)) {
+		return false;
+	}
+	strcpy(g_address.sun_path, path);
+
+	/* only a stale socket is replaced, never a file that was mistaken 
+	 * for the path */
+	struct stat status;
+	if (lstat(path, &status) == 0) {
+		if (!S_ISSOCK(status.st_mode)) {
+			errno = EEXIST;
+			return false;
+		}
+		unlink(path);
+	}
+	else if (errno != ENOENT) {
+		return false;
+	}
+
+	if ((g_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+		goto e_socket;
+	}
+
+	if (bind(g_listen_fd, (struct sockaddr *) &g_address, sizeof(g_address)) < 0 ||
+	    listen(g_listen_fd, SPECTATE_CLIENTS_MAX) < 0)
+	{
+		goto e_bind;
+	}
+
+	if ((g_epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		goto e_epoll;
+	}
+
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.u32 = SPECTATE__LISTENER,
+	};
+	if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, g_listen_fd, &event) < 0) {
+		goto e_epoll_ctl;
+	}
+	return true;
+
+e_epoll_ctl:
+	close(g_epoll_fd);
+	g_epoll_fd = -1;
+e_epoll:
+	unlink(path);
+e_bind:
+	close(g_listen_fd);
+	g_listen_fd = -1;
+e_socket:
+	return false;
+}
+
+void
+spectate_stop()
+{
+	if (g_listen_fd < 0) {
+		return;
+	}
+
+	for (u32 i = 0; i < SPECTATE_CLIENTS_MAX; ++i) {
+		if (g_clients[i].fd >= 0) {
+			spectate__drop(&g_clients[i]);
+		}
+	}
+
+	close(g_epoll_fd);
+	close(g_listen_fd);
+	unlink(g_address.sun_path);
+	g_epoll_fd = -1;
+	g_listen_fd = -1;
+}
+
+void
+spectate_service()
+{
+	if (g_listen_fd < 0) {
+		return;
+	}
+
+	struct epoll_event events [SPECTATE_CLIENTS_MAX + 1];
+	s32 const count = epoll_wait(g_epoll_fd, events, ARRAY_LENGTH(events), 0);
+
+	for (s32 i = 0; i < count; ++i) {
+		if (events[i].data.u32 == SPECTATE__LISTENER) {
+			spectate__accept();
+			continue;
+		}
+
+		struct spectate__client *client = &g_clients[events[i].data.u32];
+		if (client->fd < 0) {
+			continue;
+		}
+
+		if (events[i].events & EPOLLIN) {
+			/* spectators have nothing to say, but tell when they leave */
+			u8 discard [256];
+			ssize_t const nread = recv(client->fd, discard, sizeof(discard), MSG_DONTWAIT);
+			if (nread == 0 || (nread < 0 && errno != EAGAIN && errno != EINTR)) {
+				spectate__drop(client);
+				continue;
+			}
+		}
+
+		if (events[i].events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+			spectate__drop(client);
+			continue;
+		}
+
+		if (events[i].events & EPOLLOUT) {
+			spectate__send(client);
+		}
+	}
+}
+
+void
+spectate_frame(struct frame *frame)
+{
+	if (g_listen_fd < 0) {
+		return;
+	}
+
+	for (u32 i = 0; i < SPECTATE_CLIENTS_MAX; ++i) {
+		struct spectate__client *client = &g_clients[i];
+		if (client->fd < 0 || client->pending_size) {
+			continue;
+		}
+
+		/* left as it is, `front` still matches what it was sent */
+		if (!t_capture_begin()) {
+			if (!t_capturing()) {
+				/* nothing can be encoded for it, it attaches again
+				 * for a full frame */
+				spectate__drop(client);
+			}
+			continue;
+		}
+		frame_rasterize_delta(frame, &client->front, g_caps);
+
+		u32 size;
+		u8 const *delta = t_capture_end(&size);
+		if (!delta) {
+			/* `front` went ahead of what it could be sent */
+			spectate__drop(client);
+			continue;
+		}
+		if (!size) {
+			continue;
+		}
+
+		if (size > client->pending_capacity) {
+			u8 *pending = realloc(client->pending, size);
+			if (!pending) {
+				/* what it shows is unknown from here on */
+				spectate__drop(client);
+				continue;
+			}
+			client->pending = pending;
+			client->pending_capacity = size;
+		}
+		memcpy(client->pending, delta, size);
+		client->pending_size = size;
+
+		spectate__send(client);
+	}
+}
+
+s32
+spectate_fd()
+{
+	return g_epoll_fd;
+}
+
+u32
+spectate_num_clients()
+{
+	return g_num_clients;
+}
@@ -0,0 +1,60 @@
+#ifndef INCLUDE__SPECTATE_H
+#define INCLUDE__SPECTATE_H
+
+#include "common.h"
+#include "draw.h"
+
+
+/**
+ * Starts serving frames on a Unix domain socket at `path` (replacing
+ * a stale socket there, but nothing else), for ex. to `socat UNIX-CONNECT:<path> STDIO` from
+ * a terminal as large as the frames. Each client gets an initial full
+ * frame, then deltas against what it was last sent in full. Nothing
+ * ever blocks on a client: one that is still taking its previous delta
+ * skips frames until it is done.
+ *
+ * @param path The socket path.
+ * @param caps The `enum t_capability` flags to encode for.
+ *
+ * @return Whether the server could be started.
+ */
+bool
+spectate_start(char const *path, u32 caps);
+
+/**
+ * Disconnects all clients and removes the socket.
+ */
+void
+spectate_stop();
+
+/**
+ * Accepts new clients, sends pending output and notices clients going
+ * away, without blocking. Call this regularly, for ex. once per loop.
+ */
+void
+spectate_service();
+
+/**
+ * Encodes `frame` for every client that took all of its previous
+ * output, and starts sending it.
+ *
+ * @param frame The frame to serve.
+ */
+void
+spectate_frame(struct frame *frame);
+
+/**
+ * @return A descriptor that polls readable whenever `spectate_service`
+ *     has something to do, for ex. to sleep in epoll(7) until then, or
+ *     -1 if not serving.
+ */
+s32
+spectate_fd();
+
+/**
+ * @return The number of connected clients.
+ */
+u32
+spectate_num_clients();
+
+#endif /* INCLUDE__SPECTATE_H */
@@ -4,8 +4,15 @@
 #include <stdio.h>
 
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <termios.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 
 #include "terminal.h"
 
@@ -14,37 +21,301 @@
 #  define T_READ_BUFSZ 256
 #endif
 
+/* @TUNABLE T_EVENTS_MAX (decoded input events kept until polled, a power
+ * of two and at least T_READ_BUFSZ) */
+#ifndef T_EVENTS_MAX
+#  define T_EVENTS_MAX 1024
+#endif
+
 /* @TUNABLE T_SCRATCH_BUFSZ */
 #ifndef T_SCRATCH_BUFSZ
 #  define T_SCRATCH_BUFSZ 256
 #endif
 
-/* @TUNABLE T_WRITE_BUFSZ */
+/* @TUNABLE T_WRITE_BUFSZ (initial size of a write buffer, which grows
+ * to fit the largest frame) */
 #ifndef T_WRITE_BUFSZ
 #  define T_WRITE_BUFSZ 65536
 #endif
 
-#define T__POLL_CODES_MAX 16
-#define T__PARAMS_MAX 4
+/* @TUNABLE T_WRITE_BUFSZ_MAX (size a write buffer grows to at most, for
+ * a frame or the backlog of `T_OUTPUT_NONBLOCKING`, past which writes 
+ * are cut short) */
+#ifndef T_WRITE_BUFSZ_MAX
+#  define T_WRITE_BUFSZ_MAX (1 << 26)
+#endif
+
+/* @TUNABLE T_WRITE_NBUFS (number of write buffers in flight when the
+ * output is threaded, at least 2) */
+#ifndef T_WRITE_NBUFS
+#  define T_WRITE_NBUFS 2
+#endif
+
+/* @TUNABLE T_WRITE_SEGMENTS_MAX (pieces of output gathered by one writev(2),
+ * at most IOV_MAX) */
+#ifndef T_WRITE_SEGMENTS_MAX
+#  define T_WRITE_SEGMENTS_MAX 64
+#endif
+
+/* @TUNABLE T_SINKS_MAX (output sinks besides stdout, see `t_sink_attach`) */
+#ifndef T_SINKS_MAX
+#  define T_SINKS_MAX 8
+#endif
+
+/* @TUNABLE T_SINK_HISTORY (bytes of output kept around for sinks that are 
+ * behind, a power of two) */
+#ifndef T_SINK_HISTORY
+#  define T_SINK_HISTORY (1 << 20)
+#endif
+
+/* @TUNABLE T_RECORD_QUEUE_MAX (bytes of recording the disk may fall 
+ * behind by before the recording is given up, see `t_record_start`) */
+#ifndef T_RECORD_QUEUE_MAX
+#  define T_RECORD_QUEUE_MAX (1 << 26)
+#endif
+
+/* @TUNABLE T_ESCAPE_TIMEOUT (seconds without input after which an ESC,
+ * ESC [, ESC O or ESC P is taken as typed rather than as the start of
+ * a sequence cut in two by a read) */
+#ifndef T_ESCAPE_TIMEOUT
+#  define T_ESCAPE_TIMEOUT 0.05
+#endif
+
+#define T__PARAMS_MAX 16
 #define T__INTERS_MAX 4
 
+/* latencies are kept in microseconds, in 16 linear steps per power of
+ * two (so within ~6%) up to 2^32 */
+#define T__LATENCY_SUB_BITS 4
+#define T__LATENCY_SUBS     (1 << T__LATENCY_SUB_BITS)
+#define T__LATENCY_BUCKETS  ((32 - T__LATENCY_SUB_BITS + 1) * T__LATENCY_SUBS)
+
 /* @GLOBAL */
 static struct termios         g_tios_old;
+static s32                    g_in_fd        = STDIN_FILENO;
+static s32                    g_out_fd       = STDOUT_FILENO; /* -1 keeps it in memory */
+
+/* the size as last queried, see `t_query_size` */
+static s32                    g_size_w;
+static s32                    g_size_h;
+static u32                    g_size_generation;
+static volatile sig_atomic_t  g_size_stale   = 1;
+static struct sigaction       g_winch_old;
+static bool                   g_winch_caught;
+
+static bool                   g_mouse_enabled;
+
+/* see `t_manager_setup_headless` */
+static bool                   g_headless;
+static s32                    g_headless_w;
+static s32                    g_headless_h;
+static u8                    *g_headless_in;
+static u32                    g_headless_in_size;
+static u32                    g_headless_in_read;
+static u32                    g_headless_in_capacity;
+static u8                    *g_headless_out;
+static u32                    g_headless_out_size;
+static u32                    g_headless_out_capacity;
 
 /* input */
 static u8                     g_read_buf     [T_READ_BUFSZ];
-static u8 const              *g_read_cursor;
-static u8 const              *g_read_end;
-static u32                    g_read_buf_len;
 
-/* output */
-static u8                     g_write_buf    [T_WRITE_BUFSZ];
-static u8                    *g_write_cursor = g_write_buf;
-static u8 const * const       g_write_end    = g_write_buf + T_WRITE_BUFSZ;
+/* output, gathered into batches: the bytes written since the last 
+ * splice are the open segment `[mark, cursor)` of the current batch's
+ * buffer, and everything before it is described by `segments` so that 
+ * a flush goes out with a single writev(2) */
+struct t__segment
+{
+	u8 const                 *data; /* NULL when inside the batch buffer */
+	u32                       offset;
+	u32                       size;
+};
+
+struct t__batch
+{
+	u8                       *buffer;
+	u32                       capacity;
+	u32                       mark;
+	struct t__segment         segments [T_WRITE_SEGMENTS_MAX];
+	u32                       num_segments;
+	u32                       size; /* sum of the segment sizes */
+	double                    trace; /* oldest input it shows, see `t_latency_trace` */
+};
+
+static struct t__batch        g_batches      [T_WRITE_NBUFS];
+static u32                    g_write_index;
+
+/* being written to, per thread so that other threads can encode into
+ * captures of their own (see `t_capture_begin`) */
+static _Thread_local struct t__batch *g_batch = &g_batches[0];
+static _Thread_local u8              *g_write_buf;
+static _Thread_local u8              *g_write_cursor;
+static _Thread_local u8 const        *g_write_end;
+
+/* bumped whenever the bytes in the write buffer move or are written
+ * out, see `t_write_mark` */
+static _Thread_local u32              g_write_epoch;
+
+/* positions in the output stream: bytes queued so far, and bytes that
+ * are not referenced anymore (written or dropped), see `t_splice` */
+static u64                    g_queued;
+static u64                    g_released;
+
+static enum t_output_mode     g_output_mode;
+
+/* while a frame is open the batch grows instead of being flushed */
+static bool                   g_frame_open;
+static bool                   g_frame_synced;
+static u64                    g_frame_queued; /* as the frame opened */
+
+/* key-to-photon latency, see `t_latency_trace`, recorded by whoever
+ * writes the batch out */
+static double                 g_latency_pending; /* 0 when there is none */
+static u64                    g_latency_counts [T__LATENCY_BUCKETS];
+static u64                    g_latency_max;
+
+/* non-blocking output, the segments of `g_batches[0]` that the terminal
+ * hasn't taken yet */
+static s32                    g_stdout_flags;
+
+/* capture, see `t_capture_begin`, with the regular batch and cursors 
+ * saved aside */
+static _Thread_local struct t__batch  g_capture;
+static _Thread_local bool             g_capturing;
+static _Thread_local bool             g_capture_short; /* lost some output */
+static _Thread_local bool             g_capture_only; /* see `t_capture_thread` */
+static _Thread_local struct t__batch *g_capture_saved_batch;
+static _Thread_local u8              *g_capture_saved_buf;
+static _Thread_local u8              *g_capture_saved_cursor;
+static _Thread_local u8 const        *g_capture_saved_end;
+
+/* sinks, all fed from the history of everything flushed since the 
+ * first was attached: the stream byte at `p` is at `g_history[p % 
+ * T_SINK_HISTORY]`, up to (excluding) `g_history_head` */
+struct t__sink
+{
+	s32                       fd;
+	s32                       flags;
+	bool                      attached;
+	bool                      resync; /* lost track, see `t_sink_resync` */
+	u64                       position;
+
+	/* private output sent before resuming from `position` */
+	u8                       *repaint;
+	u32                       repaint_size;
+	u32                       repaint_sent;
+};
+
+static struct t__sink         g_sinks        [T_SINKS_MAX];
+static u32                    g_num_sinks;
+static u8                    *g_history;
+static u64                    g_history_head;
+
+/* recording, see `t_record_start` */
+static s32                    g_record_fd    = -1;
+static double               (*g_record_clock)();
+static double                 g_record_start;
+static char                  *g_record_event; /* escaped output of this flush */
+static u32                    g_record_event_size;
+static u32                    g_record_event_capacity;
+static u8                     g_record_utf8  [4]; /* see `t__record_append` */
+static u32                    g_record_utf8_size;
+static u32                    g_record_utf8_need;
+
+/* recorder thread, writes out the events queued by the flushes so that
+ * a slow disk never holds up the output */
+static pthread_t              g_recorder;
+static pthread_mutex_t        g_recorder_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t         g_recorder_wake = PTHREAD_COND_INITIALIZER;
+static bool                   g_recorder_running;
+static bool                   g_recorder_failed;
+static char                  *g_record_queue; /* events not taken yet */
+static u32                    g_record_queue_size;
+static u32                    g_record_queue_capacity;
+
+/* writer thread, owns the queued batches `[g_writer_head, g_writer_head 
+ * + g_writer_queued)` (modulo T_WRITE_NBUFS) */
+static pthread_t              g_writer;
+static pthread_mutex_t        g_writer_lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t         g_writer_wake  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t         g_writer_done  = PTHREAD_COND_INITIALIZER;
+static u32                    g_writer_head;
+static u32                    g_writer_queued;
+static bool                   g_writer_running;
+static bool                   g_writer_failed;
 
 static char                  *g_write_f_buf;
 static u32                    g_write_f_buf_size;
 
+static u32                    g_capabilities;
+
+#ifdef TC_DEBUG_METRICS
+/* totals, updated atomically since the writer thread also writes */
+static u64                    g_debug_bytes_buffered;
+static u64                    g_debug_bytes_formatted;
+static u64                    g_debug_bytes_flushed;
+static u64                    g_debug_num_writes;
+static u64                    g_debug_num_short_writes;
+static u64                    g_debug_nanos_blocked;
+static u64                    g_debug_bytes_sunk;
+static u64                    g_debug_bytes_recorded;
+
+static struct t_debug_metrics g_debug_frame_base;
+
+#  define T__DEBUG_ADD(counter, amount) \
+	__atomic_fetch_add(&(counter), (amount), __ATOMIC_RELAXED)
+
+/* captured bytes only count as output once spliced into it */
+#  define T__DEBUG_OUTPUT(counter, amount) \
+	do { if (!g_capturing) T__DEBUG_ADD(counter, amount); } while (0)
+#else
+#  define T__DEBUG_ADD(counter, amount)
+#  define T__DEBUG_OUTPUT(counter, amount)
+#endif
+
+/* pre-encoded sequences, `X(n)` expanded for every n from 0 to 255 */
+#define T__SGR_SEQ_SIZE 16
+
+#define T__TENS(X, H) \
+	X(H##0), X(H##1), X(H##2), X(H##3), X(H##4), \
+	X(H##5), X(H##6), X(H##7), X(H##8), X(H##9)
+#define T__EACH_256(X) \
+	X(0), X(1), X(2), X(3), X(4), X(5), X(6), X(7), X(8), X(9), \
+	T__TENS(X, 1), T__TENS(X, 2), T__TENS(X, 3), T__TENS(X, 4), \
+	T__TENS(X, 5), T__TENS(X, 6), T__TENS(X, 7), T__TENS(X, 8), \
+	T__TENS(X, 9), T__TENS(X, 10), T__TENS(X, 11), T__TENS(X, 12), \
+	T__TENS(X, 13), T__TENS(X, 14), T__TENS(X, 15), T__TENS(X, 16), \
+	T__TENS(X, 17), T__TENS(X, 18), T__TENS(X, 19), T__TENS(X, 20), \
+	T__TENS(X, 21), T__TENS(X, 22), T__TENS(X, 23), T__TENS(X, 24), \
+	X(250), X(251), X(252), X(253), X(254), X(255)
+
+#define T__SGR_FG(N)  "\x1b[38;5;" #N "m"
+#define T__SGR_BG(N)  "\x1b[48;5;" #N "m"
+#define T__SGR_LEN(N) (sizeof(T__SGR_FG(N)) - 1)
+
+static u8 const               g_sgr_fg_256   [256][T__SGR_SEQ_SIZE] = { T__EACH_256(T__SGR_FG) };
+static u8 const               g_sgr_bg_256   [256][T__SGR_SEQ_SIZE] = { T__EACH_256(T__SGR_BG) };
+static u8 const               g_sgr_256_len  [256] = { T__EACH_256(T__SGR_LEN) };
+
+static char const             g_digit_pairs  [] = 
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static void
+t__winch(int signal)
+{
+	UNUSED(signal);
+	g_size_stale = 1;
+}
+
 bool
 t_manager_setup()
 {
@@ -65,6 +336,15 @@ t_manager_setup()
 	now.c_cc[VMIN] = 0; /* min of 0 characters for read(3) */
 	tcsetattr(STDIN_FILENO, TCSANOW, &now);
 
+	/* the size is only queried again once it changed */
+	struct sigaction winch = {
+		.sa_handler = t__winch,
+		.sa_flags = SA_RESTART,
+	};
+	sigemptyset(&winch.sa_mask);
+	g_winch_caught = sigaction(SIGWINCH, &winch, &g_winch_old) == 0;
+	g_size_stale = 1;
+
 	return true;
 }
 
@@ -75,54 +355,403 @@ t_manager_cleanup()
 	/* flush any remaining output in case things like `cursor_show()`
 	 * are called at the end to restore defaults.
 	 */
+	t_mouse_disable();
 	t_reset();
+	t_output_mode_set(T_OUTPUT_DIRECT);
 	t_flush();
 
-	/* reset terminal settings back to normal */
-	tcsetattr(STDIN_FILENO, TCSANOW, &g_tios_old);
+	for (u32 i = 0; i < T_SINKS_MAX; ++i) {
+		t_sink_detach(i);
+	}
+	t_record_stop();
+
+	if (g_headless) {
+		free(g_headless_in);
+		free(g_headless_out);
+		g_headless_in = NULL;
+		g_headless_out = NULL;
+		g_headless_in_size = g_headless_in_read = g_headless_in_capacity = 0;
+		g_headless_out_size = g_headless_out_capacity = 0;
+		g_headless = false;
+		g_in_fd = STDIN_FILENO;
+		g_out_fd = STDOUT_FILENO;
+		g_size_stale = 1;
+		return;
+	}
+
+	if (g_winch_caught) {
+		sigaction(SIGWINCH, &g_winch_old, NULL);
+		g_winch_caught = false;
+	}
+
+	/* reset terminal settings back to normal, dropping any input left
+	 * unread (like late replies to `t_capabilities_query`) so it doesn't
+	 * end up at the shell */
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &g_tios_old);
+}
+
+/* Queries the size anew, moving on to the next generation if it changed. */
+static void
+t__size_refresh()
+{
+	/* first, so that a resize coming in meanwhile isn't lost */
+	g_size_stale = 0;
+
+	s32 w = g_headless_w, h = g_headless_h;
+
+	struct winsize ws;
+	if (g_headless) {
+		/* virtual size */
+	}
+	else if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col && ws.ws_row) {
+		w = ws.ws_col;
+		h = ws.ws_row;
+	}
+	else {
+		/* stdout is not the terminal (redirected, or there is none),
+		 * go by what the shell says or the good old default */
+		char const *columns = getenv("COLUMNS");
+		char const *lines = getenv("LINES");
+		w = columns ? atoi(columns) : 0;
+		h = lines ? atoi(lines) : 0;
+		if (w <= 0) w = 80;
+		if (h <= 0) h = 24;
+	}
+
+	if (w != g_size_w || h != g_size_h) {
+		g_size_w = w;
+		g_size_h = h;
+		++g_size_generation;
+	}
 }
 
 void
 t_query_size(s32 *out_w, s32 *out_h)
 {
-	struct winsize ws;
-	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0) {
-		/* @TODO(max): what to do here ? */
-		return;
+	if (g_size_stale) {
+		t__size_refresh();
+	}
+	if (out_w) *out_w = g_size_w;
+	if (out_h) *out_h = g_size_h;
+}
+
+void
+t_resize_notify()
+{
+	g_size_stale = 1;
+}
+
+u32
+t_size_generation()
+{
+	if (g_size_stale) {
+		t__size_refresh();
+	}
+	return g_size_generation;
+}
+
+/* @SECTION(headless) */
+bool
+t_manager_setup_headless(struct t_headless const *headless)
+{
+	g_headless = true;
+	g_headless_w = MAX(headless->width, 1);
+	g_headless_h = MAX(headless->height, 1);
+	g_size_stale = 1;
+	g_in_fd = -1;
+	g_out_fd = headless->fd;
+
+	if (headless->input_size) {
+		return t_headless_input(headless->input, headless->input_size);
+	}
+	return true;
+}
+
+s32
+t_input_fd()
+{
+	return g_in_fd;
+}
+
+s32
+t_output_fd()
+{
+	return g_out_fd;
+}
+
+bool
+t_headless()
+{
+	return g_headless;
+}
+
+void
+t_headless_resize(s32 w, s32 h)
+{
+	g_headless_w = MAX(w, 1);
+	g_headless_h = MAX(h, 1);
+	g_size_stale = 1;
+}
+
+bool
+t_headless_input(u8 const *data, u32 size)
+{
+	/* drop what was read already before making room */
+	memmove(g_headless_in, g_headless_in + g_headless_in_read,
+		g_headless_in_size - g_headless_in_read
+	);
+	g_headless_in_size -= g_headless_in_read;
+	g_headless_in_read = 0;
+
+	if (g_headless_in_size + size > g_headless_in_capacity) {
+		u32 const capacity = MAX(g_headless_in_capacity * 2, g_headless_in_size + size);
+		u8 *input = realloc(g_headless_in, capacity);
+		if (!input) {
+			return false;
+		}
+		g_headless_in = input;
+		g_headless_in_capacity = capacity;
 	}
 
-	if (out_w) *out_w = (s32) ws.ws_col;
-	if (out_h) *out_h = (s32) ws.ws_row;
+	memcpy(g_headless_in + g_headless_in_size, data, size);
+	g_headless_in_size += size;
+	return true;
+}
+
+u8 const *
+t_headless_output(u32 *out_size)
+{
+	t_flush();
+	if (out_size) *out_size = g_headless_out_size;
+	return g_headless_out;
+}
+
+void
+t_headless_output_clear()
+{
+	g_headless_out_size = 0;
+}
+
+/* read(2) from the headless input. */
+static ssize_t
+t__headless_read(u8 *buffer, u32 size)
+{
+	u32 const count = MIN(size, g_headless_in_size - g_headless_in_read);
+	memcpy(buffer, g_headless_in + g_headless_in_read, count);
+	g_headless_in_read += count;
+	return count;
 }
 
-enum epm_code /* escape pars(er|ing) machine */
+/* writev(2) to the headless output in memory. */
+static ssize_t
+t__headless_writev(struct iovec const *iov, u32 count)
 {
-	/* parsing codes */
-	EPM_DETERMINE,
+	u64 size = 0;
+	for (u32 i = 0; i < count; ++i) {
+		size += iov[i].iov_len;
+	}
+
+	if (g_headless_out_size + size > g_headless_out_capacity) {
+		u64 const capacity = MAX(g_headless_out_capacity * 2ull, g_headless_out_size + size);
+		u8 *output = capacity <= UINT32_MAX ? realloc(g_headless_out, capacity) : NULL;
+		if (!output) {
+			errno = ENOSPC;
+			return -1;
+		}
+		g_headless_out = output;
+		g_headless_out_capacity = capacity;
+	}
+
+	for (u32 i = 0; i < count; ++i) {
+		memcpy(g_headless_out + g_headless_out_size, iov[i].iov_base, iov[i].iov_len);
+		g_headless_out_size += iov[i].iov_len;
+	}
+	return size;
+}
 
-	EPM_NORMAL,
-	EPM_CONTROL,
+u32
+t_capabilities()
+{
+	return g_capabilities;
+}
 
-	EPM_ESCAPE,
-	EPM_ESCAPE_BRACKET,
+void
+t_capabilities_set(u32 capabilities)
+{
+	g_capabilities = capabilities;
+}
 
-	EPM_SS3_FUNC,
+/* The input decoder is a DFA over classes of bytes, each byte moves it
+ * to the next state running an action on the way (see `g_in_dfa`). */
+enum t__in_class
+{
+	T__CLASS_C0,       /* C0 controls, but BEL and ESC */
+	T__CLASS_BEL,
+	T__CLASS_ESC,
+	T__CLASS_INTER,    /* 0x20-0x2f */
+	T__CLASS_DIGIT,
+	T__CLASS_SEP,      /* ':' and ';' */
+	T__CLASS_PRIVATE,  /* '<' to '?' */
+	T__CLASS_SS3,      /* 'O' */
+	T__CLASS_DCS,      /* 'P' */
+	T__CLASS_CSI,      /* '[' */
+	T__CLASS_FINAL,    /* the rest of 0x40-0x7e */
+	T__CLASS_DEL,
+	T__CLASS_HIGH,     /* 0x80-0xff */
+	T__NUM_CLASSES,
+};
 
-	EPM_PARAM,
-	EPM_PARAM_EMIT,
+enum t__in_state
+{
+	T__STATE_GROUND,
+	T__STATE_ESCAPE,
+	T__STATE_CSI_PARAM,
+	T__STATE_CSI_INTER,
+	T__STATE_SS3,
+	T__STATE_DCS,
+	T__STATE_DCS_ESCAPE,
+	T__NUM_STATES,
+};
 
-	EPM_INTER,
+enum t__in_action
+{
+	T__DO_IGNORE,
+	T__DO_KEY,          /* the byte as it is */
+	T__DO_CONTROL,      /* control and the byte */
+	T__DO_ALT,          /* alt and the byte */
+	T__DO_ALT_CONTROL,
+	T__DO_ESCAPE_KEY,   /* a lone escape, before another sequence */
+	T__DO_BEGIN,        /* a new sequence */
+	T__DO_DCS_BEGIN,    /* a DCS reply, or alt+P if none is expected */
+	T__DO_DIGIT,
+	T__DO_SEP,
+	T__DO_PRIVATE,
+	T__DO_INTER,
+	T__DO_CSI,
+	T__DO_SS3,
+	T__DO_DCS_PUT,
+	T__DO_DCS,
+};
 
-	/* state change codes */
-	EPM_RESET,
-	EPM_READ,
+struct t__in_transition
+{
+	u8 next;
+	u8 action;
+};
 
-	/* halt codes */
-	EPM_HALT_UNKNOWN,
-	EPM_HALT_IF_EMPTY,
-	EPM_HALT_EMIT,
+#define T__TO(state, action) { T__STATE_##state, T__DO_##action }
+
+static struct t__in_transition const g_in_dfa [T__NUM_STATES][T__NUM_CLASSES] = {
+	[T__STATE_GROUND] = {
+		[T__CLASS_C0]      = T__TO(GROUND, CONTROL),
+		[T__CLASS_BEL]     = T__TO(GROUND, CONTROL),
+		[T__CLASS_ESC]     = T__TO(ESCAPE, BEGIN),
+		[T__CLASS_INTER]   = T__TO(GROUND, KEY),
+		[T__CLASS_DIGIT]   = T__TO(GROUND, KEY),
+		[T__CLASS_SEP]     = T__TO(GROUND, KEY),
+		[T__CLASS_PRIVATE] = T__TO(GROUND, KEY),
+		[T__CLASS_SS3]     = T__TO(GROUND, KEY),
+		[T__CLASS_DCS]     = T__TO(GROUND, KEY),
+		[T__CLASS_CSI]     = T__TO(GROUND, KEY),
+		[T__CLASS_FINAL]   = T__TO(GROUND, KEY),
+		[T__CLASS_DEL]     = T__TO(GROUND, KEY),
+		[T__CLASS_HIGH]    = T__TO(GROUND, KEY),
+	},
+	[T__STATE_ESCAPE] = {
+		[T__CLASS_C0]      = T__TO(GROUND, ALT_CONTROL),
+		[T__CLASS_BEL]     = T__TO(GROUND, ALT_CONTROL),
+		[T__CLASS_ESC]     = T__TO(ESCAPE, ESCAPE_KEY),
+		[T__CLASS_INTER]   = T__TO(GROUND, ALT),
+		[T__CLASS_DIGIT]   = T__TO(GROUND, ALT),
+		[T__CLASS_SEP]     = T__TO(GROUND, ALT),
+		[T__CLASS_PRIVATE] = T__TO(GROUND, ALT),
+		[T__CLASS_SS3]     = T__TO(SS3, IGNORE),
+		[T__CLASS_DCS]     = T__TO(DCS, DCS_BEGIN),
+		[T__CLASS_CSI]     = T__TO(CSI_PARAM, IGNORE),
+		[T__CLASS_FINAL]   = T__TO(GROUND, ALT),
+		[T__CLASS_DEL]     = T__TO(GROUND, ALT),
+		[T__CLASS_HIGH]    = T__TO(GROUND, ALT),
+	},
+	[T__STATE_CSI_PARAM] = {
+		[T__CLASS_C0]      = T__TO(CSI_PARAM, IGNORE),
+		[T__CLASS_BEL]     = T__TO(CSI_PARAM, IGNORE),
+		[T__CLASS_ESC]     = T__TO(ESCAPE, BEGIN),
+		[T__CLASS_INTER]   = T__TO(CSI_INTER, INTER),
+		[T__CLASS_DIGIT]   = T__TO(CSI_PARAM, DIGIT),
+		[T__CLASS_SEP]     = T__TO(CSI_PARAM, SEP),
+		[T__CLASS_PRIVATE] = T__TO(CSI_PARAM, PRIVATE),
+		[T__CLASS_SS3]     = T__TO(GROUND, CSI),
+		[T__CLASS_DCS]     = T__TO(GROUND, CSI),
+		[T__CLASS_CSI]     = T__TO(GROUND, CSI),
+		[T__CLASS_FINAL]   = T__TO(GROUND, CSI),
+		[T__CLASS_DEL]     = T__TO(CSI_PARAM, IGNORE),
+		[T__CLASS_HIGH]    = T__TO(GROUND, IGNORE),
+	},
+	[T__STATE_CSI_INTER] = {
+		[T__CLASS_C0]      = T__TO(CSI_INTER, IGNORE),
+		[T__CLASS_BEL]     = T__TO(CSI_INTER, IGNORE),
+		[T__CLASS_ESC]     = T__TO(ESCAPE, BEGIN),
+		[T__CLASS_INTER]   = T__TO(CSI_INTER, INTER),
+		[T__CLASS_DIGIT]   = T__TO(CSI_INTER, IGNORE),
+		[T__CLASS_SEP]     = T__TO(CSI_INTER, IGNORE),
+		[T__CLASS_PRIVATE] = T__TO(CSI_INTER, IGNORE),
+		[T__CLASS_SS3]     = T__TO(GROUND, CSI),
+		[T__CLASS_DCS]     = T__TO(GROUND, CSI),
+		[T__CLASS_CSI]     = T__TO(GROUND, CSI),
+		[T__CLASS_FINAL]   = T__TO(GROUND, CSI),
+		[T__CLASS_DEL]     = T__TO(CSI_INTER, IGNORE),
+		[T__CLASS_HIGH]    = T__TO(GROUND, IGNORE),
+	},
+	[T__STATE_SS3] = {
+		[T__CLASS_C0]      = T__TO(GROUND, IGNORE),
+		[T__CLASS_BEL]     = T__TO(GROUND, IGNORE),
+		[T__CLASS_ESC]     = T__TO(ESCAPE, BEGIN),
+		[T__CLASS_INTER]   = T__TO(GROUND, IGNORE),
+		[T__CLASS_DIGIT]   = T__TO(SS3, DIGIT),
+		[T__CLASS_SEP]     = T__TO(SS3, SEP),
+		[T__CLASS_PRIVATE] = T__TO(GROUND, IGNORE),
+		[T__CLASS_SS3]     = T__TO(GROUND, SS3),
+		[T__CLASS_DCS]     = T__TO(GROUND, SS3),
+		[T__CLASS_CSI]     = T__TO(GROUND, SS3),
+		[T__CLASS_FINAL]   = T__TO(GROUND, SS3),
+		[T__CLASS_DEL]     = T__TO(GROUND, IGNORE),
+		[T__CLASS_HIGH]    = T__TO(GROUND, IGNORE),
+	},
+	[T__STATE_DCS] = {
+		[T__CLASS_C0]      = T__TO(DCS, DCS_PUT),
+		[T__CLASS_BEL]     = T__TO(GROUND, DCS),
+		[T__CLASS_ESC]     = T__TO(DCS_ESCAPE, IGNORE),
+		[T__CLASS_INTER]   = T__TO(DCS, DCS_PUT),
+		[T__CLASS_DIGIT]   = T__TO(DCS, DCS_PUT),
+		[T__CLASS_SEP]     = T__TO(DCS, DCS_PUT),
+		[T__CLASS_PRIVATE] = T__TO(DCS, DCS_PUT),
+		[T__CLASS_SS3]     = T__TO(DCS, DCS_PUT),
+		[T__CLASS_DCS]     = T__TO(DCS, DCS_PUT),
+		[T__CLASS_CSI]     = T__TO(DCS, DCS_PUT),
+		[T__CLASS_FINAL]   = T__TO(DCS, DCS_PUT),
+		[T__CLASS_DEL]     = T__TO(DCS, DCS_PUT),
+		[T__CLASS_HIGH]    = T__TO(DCS, DCS_PUT),
+	},
+	/* the backslash of ST, or whatever else comes */
+	[T__STATE_DCS_ESCAPE] = {
+		[T__CLASS_C0]      = T__TO(GROUND, DCS),
+		[T__CLASS_BEL]     = T__TO(GROUND, DCS),
+		[T__CLASS_ESC]     = T__TO(GROUND, DCS),
+		[T__CLASS_INTER]   = T__TO(GROUND, DCS),
+		[T__CLASS_DIGIT]   = T__TO(GROUND, DCS),
+		[T__CLASS_SEP]     = T__TO(GROUND, DCS),
+		[T__CLASS_PRIVATE] = T__TO(GROUND, DCS),
+		[T__CLASS_SS3]     = T__TO(GROUND, DCS),
+		[T__CLASS_DCS]     = T__TO(GROUND, DCS),
+		[T__CLASS_CSI]     = T__TO(GROUND, DCS),
+		[T__CLASS_FINAL]   = T__TO(GROUND, DCS),
+		[T__CLASS_DEL]     = T__TO(GROUND, DCS),
+		[T__CLASS_HIGH]    = T__TO(GROUND, DCS),
+	},
 };
 
+#undef T__TO
+
 /* https://invisible-island.net/xterm/ctlseqs/ctlseqs.html#h3-PC-Style-Function-Keys */
 /* @NOTE(max): the way T_* keys are assigned, this table is actually just
  * an identity table, so it may be removed if the modifiers are not
@@ -162,11 +791,15 @@ static enum t_poll_special const g_pc_keyspec_table [] = {
 };
 
 /* @GLOBAL */
-static enum epm_code          g_codes        [T__POLL_CODES_MAX];
-static u32                    g_code_p;
+/* input decoder, see `t_poll_batch` */
+static u8                     g_in_classes   [256];
+static bool                   g_in_classes_ready;
+static u8                     g_in_state;
+static double                 g_in_time;     /* of the last read */
 
 static u16                    g_params       [T__PARAMS_MAX];
-static u32                    g_param_p;
+static u32                    g_param_p;     /* the one being read */
+static bool                   g_param_any;
 
 static u8                     g_inters       [T__INTERS_MAX];
 static u32                    g_inter_p;
@@ -174,282 +807,1927 @@ static u32                    g_inter_p;
 static u8                     g_scratch      [T_SCRATCH_BUFSZ];
 static u32                    g_scratch_p;
 
-static u8                     g_mod;
-static u8                     g_val;
-static bool                   g_is_escape;
+static u8                     g_private; /* CSI private marker, ex. '?' */
+
+/* decoded, `[g_events_head, g_events_tail)` modulo T_EVENTS_MAX */
+static struct t_event         g_events       [T_EVENTS_MAX];
+static u32                    g_events_head;
+static u32                    g_events_tail;
+
+/* capability queries, see `t_capabilities_query` */
+static struct t_terminal_info g_info;
+static bool                   g_query_pending;
+static bool                   g_query_sent;  /* replies may come in late */
+static struct timespec        g_query_deadline;
+static u8                     g_query_sync; /* DECRQM 2026 reply, 0 if none */
            
-static enum epm_code
-epm_push(
-	enum epm_code code
-) {
-	/* @TODO(max): overflow not protected, need proper error handling */
-	return g_codes[g_code_p++] = code;
-}
-
-static enum epm_code
-epm_push_init(
-	enum epm_code code
-) {
-	/* @NOTE(max): this was a common idiom in the poll epmine below,
-	 * and most codes using it were postfixed with "_INIT," hence the
-	 * function name.
-	 *
-	 * @TODO(max): this function may be confusing when writing out
-	 * case statements in the actual epmine since there is no 
-	 * indication that a code depends on this type of form.
-	 */
-	epm_push(code);
-	if (g_read_end <= g_read_cursor) {
-		epm_push(EPM_READ);
+/* @SECTION(capabilities) */
+/* XTVERSION name prefixes of terminals known to do 24-bit colors */
+static char const * const     g_rgb_terminals [] = {
+	"XTerm(", "kitty(", "WezTerm", "foot(", "iTerm2", "tmux", 
+	"ghostty", "contour", "mintty", "Konsole",
+};
+
+/* XTVERSION name prefixes of terminals known to do REP, which DA1 says
+ * nothing about */
+static char const * const     g_rep_terminals [] = {
+	"XTerm(", "kitty(", "WezTerm", "foot(", "tmux", "ghostty", 
+	"contour", "mintty",
+};
+
+/* Whether the XTVERSION reply starts with any of `names`. */
+static bool
+t__capabilities_named(char const * const *names, u32 num_names)
+{
+	for (u32 i = 0; i < num_names; ++i) {
+		if (!strncmp(g_info.version, names[i], strlen(names[i]))) {
+			return true;
+		}
 	}
-	return code;
+	return false;
 }
 
-enum epm_code
-epm_pop()
+static bool
+t__capabilities_rgb()
 {
-	/* @TODO(max): underflow not protected, need proper error handling */
-	return g_codes[--g_code_p];
+	char const *colorterm = getenv("COLORTERM");
+	if (colorterm && 
+	    (!strcmp(colorterm, "truecolor") || !strcmp(colorterm, "24bit"))) 
+	{
+		return true;
+	}
+	return t__capabilities_named(g_rgb_terminals, ARRAY_LENGTH(g_rgb_terminals));
 }
 
-static u8
-epm_cursor_inc() 
+/* Concludes the detection with whatever replies came in. */
+static void
+t__capabilities_done()
 {
-	/* @TODO(max): overflow not protected, bad? */
-	return *g_read_cursor++;
+	if (!g_query_pending) {
+		return;
+	}
+	g_query_pending = false;
+
+	u32 capabilities = 0;
+
+	/* VT220 and up, which in practice all do ECH and background color 
+	 * erase; REP only by name, as plenty of them answer 62 without */
+	if (g_info.conformance >= 62) {
+		capabilities |= T_CAP_ERASE;
+		if (t__capabilities_named(g_rep_terminals, ARRAY_LENGTH(g_rep_terminals))) {
+			capabilities |= T_CAP_REP;
+		}
+	}
+
+	/* DECRPM: 1 set, 2 reset, 3 permanently set (0 and 4 for unknown 
+	 * and permanently reset modes) */
+	if (1 <= g_query_sync && g_query_sync <= 3) {
+		capabilities |= T_CAP_SYNC;
+	}
+
+	if (t__capabilities_rgb()) {
+		capabilities |= T_CAP_RGB;
+	}
+
+	g_info.capabilities = capabilities;
+	g_capabilities |= capabilities;
 }
 
-u16
-t_poll()
+/* Takes in a CSI reply (one with a private marker), see `t_poll_batch`. */
+static void
+t__capabilities_reply(u8 final)
 {
-	if (!g_code_p) epm_push(EPM_RESET);
+	switch (final) {
+	case 'c':
+		if (g_private == '?') {
+			/* DA1, the last reply to come in */
+			g_info.conformance = g_params[0];
+			t__capabilities_done();
+		}
+		else if (g_private == '>') {
+			/* DA2 */
+			g_info.type = g_params[0];
+			g_info.firmware = g_params[1];
+		}
+		break;
+
+	case 'y':
+		/* DECRPM */
+		if (g_private == '?' && g_inter_p && g_inters[0] == '$' && 
+		    g_params[0] == 2026) 
+		{
+			g_query_sync = g_params[1];
+		}
+		break;
+	}
+}
 
-	while (g_code_p > 0) {
-		enum epm_code const code = epm_pop();
-		u32 const available = g_read_cursor <= g_read_end ? 
-			g_read_end - g_read_cursor : 0;
+/* Takes in a DCS reply collected in the scratch buffer. */
+static void
+t__capabilities_reply_dcs()
+{
+	/* XTVERSION, `DCS > | text ST` */
+	if (g_scratch_p >= 2 && g_scratch[0] == '>' && g_scratch[1] == '|') {
+		u32 const length = MIN(g_scratch_p - 2, sizeof(g_info.version) - 1);
+		memcpy(g_info.version, g_scratch + 2, length);
+		g_info.version[length] = '\0';
+	}
+	g_scratch_p = 0;
+}
 
-		switch (code) {
-		case EPM_DETERMINE:
-			if (!available) {
-				epm_push(code);
-				epm_push(EPM_HALT_IF_EMPTY);
-				epm_push(EPM_READ);
-			}
-			else if (g_read_cursor[0] == '\x1b') {
-				epm_push_init(EPM_ESCAPE);
-				epm_cursor_inc();
-			}
-			else if (0x00 <= g_read_cursor[0] &&
-			                 g_read_cursor[0] <= 0x1f) {
-				epm_push(EPM_CONTROL);
-			}
-			else {
-				epm_push(EPM_NORMAL);
-			}
+bool
+t_capabilities_query(double timeout)
+{
+	memset(&g_info, 0, sizeof(g_info));
+	g_query_sync = 0;
+
+	/* DA1 goes last: every terminal answers it and replies come in 
+	 * order, so once it's in the others are either in too or never
+	 * coming */
+	u32 const written = t_writez(
+		"\x1b[>0q"      /* XTVERSION */
+		"\x1b[>c"       /* DA2 */
+		"\x1b[?2026$p"  /* DECRQM, synchronized updates */
+		"\x1b[c"        /* DA1 */
+	);
+	t_flush();
+	if (!written) {
+		return false;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &g_query_deadline);
+	u64 const nanos = g_query_deadline.tv_nsec + (u64) (timeout * 1e9);
+	g_query_deadline.tv_sec += nanos / 1000000000;
+	g_query_deadline.tv_nsec = nanos % 1000000000;
+
+	g_query_pending = true;
+	g_query_sent = true;
+	return true;
+}
+
+bool
+t_capabilities_pending()
+{
+	return g_query_pending;
+}
+
+struct t_terminal_info const *
+t_terminal_info()
+{
+	return &g_info;
+}
+
+/* Settles for whatever replies came in once the query timed out. */
+static void
+t__capabilities_tick()
+{
+	if (!g_query_pending) {
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec > g_query_deadline.tv_sec ||
+	    (now.tv_sec == g_query_deadline.tv_sec && 
+	     now.tv_nsec >= g_query_deadline.tv_nsec))
+	{
+		t__capabilities_done();
+	}
+}
+
+/* @SECTION(input) */
+static void
+t__in_classes_init()
+{
+	for (u32 c = 0; c < 0x20; ++c)    g_in_classes[c] = T__CLASS_C0;
+	for (u32 c = 0x20; c < 0x30; ++c) g_in_classes[c] = T__CLASS_INTER;
+	for (u32 c = '0'; c <= '9'; ++c)  g_in_classes[c] = T__CLASS_DIGIT;
+	for (u32 c = '<'; c <= '?'; ++c)  g_in_classes[c] = T__CLASS_PRIVATE;
+	for (u32 c = 0x40; c < 0x7f; ++c) g_in_classes[c] = T__CLASS_FINAL;
+	for (u32 c = 0x80; c < 0x100; ++c) g_in_classes[c] = T__CLASS_HIGH;
+
+	g_in_classes['\x07'] = T__CLASS_BEL;
+	g_in_classes['\x1b'] = T__CLASS_ESC;
+	g_in_classes[':'] = T__CLASS_SEP;
+	g_in_classes[';'] = T__CLASS_SEP;
+	g_in_classes['O'] = T__CLASS_SS3;
+	g_in_classes['P'] = T__CLASS_DCS;
+	g_in_classes['['] = T__CLASS_CSI;
+	g_in_classes['\x7f'] = T__CLASS_DEL;
+
+	g_in_classes_ready = true;
+}
+
+/* Queues an event with the parameters read so far (`num_params` of 
+ * them), `t__in_read` sees to it that there is room. */
+static void
+t__in_emit(u16 code, u32 num_params)
+{
+	struct t_event *event = &g_events[g_events_tail++ & (T_EVENTS_MAX - 1)];
+	event->code = code;
+	event->num_params = MIN(num_params, T_EVENT_PARAMS_MAX);
+	event->time = g_in_time;
+	for (u32 i = 0; i < event->num_params; ++i) {
+		event->params[i] = g_params[i];
+	}
+}
+
+static u32
+t__in_num_params()
+{
+	return g_param_any ? MIN(g_param_p + 1, T__PARAMS_MAX) : 0;
+}
+
+/* Takes in an SGR mouse report, CSI < b;x;y ending in M (or m once
+ * released). */
+static void
+t__in_mouse(u8 final)
+{
+	u16 const b = g_params[0];
+	if (t__in_num_params() < 3 || b >= 128) {
+		/* not one of the buttons told apart */
+		return;
+	}
+
+	u8 modifiers = T_SPECIAL;
+	if (b & 4)  modifiers |= T_SHIFT;
+	if (b & 8)  modifiers |= T_ALT;
+	if (b & 16) modifiers |= T_CONTROL;
+
+	u8 const value = 
+		final == 'm' ? T_MOUSE_RELEASE : 
+		b & 64 ? T_MOUSE_WHEEL : 
+		b & 32 ? T_MOUSE_MOTION : T_MOUSE_PRESS;
+	u16 const code = T_POLL_CODE(modifiers, value);
+
+	g_params[0] = b & 3;
+	g_params[1] = g_params[1] ? g_params[1] - 1 : 0;
+	g_params[2] = g_params[2] ? g_params[2] - 1 : 0;
+
+	/* only where a drag ends up matters, but it has been waited on
+	 * since the first of the run */
+	if (value == T_MOUSE_MOTION && g_events_head != g_events_tail) {
+		struct t_event *last = &g_events[(g_events_tail - 1) & (T_EVENTS_MAX - 1)];
+		if (last->code == code && last->params[0] == g_params[0]) {
+			last->params[1] = g_params[1];
+			last->params[2] = g_params[2];
+			return;
+		}
+	}
+	t__in_emit(code, 3);
+}
+
+/* Takes in a complete CSI sequence ending in `final`. */
+static void
+t__in_csi(u8 final)
+{
+	if (g_private == '<' && (final == 'M' || final == 'm')) {
+		t__in_mouse(final);
+		return;
+	}
+	if (g_private) {
+		t__capabilities_reply(final);
+		return;
+	}
+	if (g_inter_p) {
+		/* no keys are sent like this */
+		return;
+	}
+
+	u8 value = final;
+	if (final == '~') {
+		/* F5+ keys */
+		value = g_params[0] < ARRAY_LENGTH(g_pc_keyspec_table) ? 
+			g_pc_keyspec_table[g_params[0]] : T_UNKNOWN;
+	}
+	else if (0x50 <= final && final <= 0x54) {
+		/* F1-F4 keys with modifiers */
+		value = final - 0x4f;
+	}
+	/* arrow keys are set so that the final byte already is their code */
+
+	u8 modifiers = T_SPECIAL;
+	if (t__in_num_params() > 1 && g_params[1] < ARRAY_LENGTH(g_pc_keymod_table)) {
+		modifiers |= g_pc_keymod_table[g_params[1]];
+	}
+	t__in_emit(T_POLL_CODE(modifiers, value), t__in_num_params());
+}
+
+/* Takes in a complete SS3 sequence (application keypad and cursor keys,
+ * F1-F4) ending in `final`. */
+static void
+t__in_ss3(u8 final)
+{
+	u8 const value = 'P' <= final && final <= 'S' ? final - 0x4f : final;
+
+	u8 modifiers = T_SPECIAL;
+	if (g_param_any && g_params[0] < ARRAY_LENGTH(g_pc_keymod_table)) {
+		modifiers |= g_pc_keymod_table[g_params[0]];
+	}
+	t__in_emit(T_POLL_CODE(modifiers, value), t__in_num_params());
+}
+
+/* Runs `[data, data + size)` through the decoder in one go. */
+static void
+t__in_decode(u8 const *data, u32 size)
+{
+	u8 state = g_in_state;
+
+	for (u32 i = 0; i < size; ++i) {
+		u8 const ch = data[i];
+		struct t__in_transition const transition = g_in_dfa[state][g_in_classes[ch]];
+		state = transition.next;
+
+		switch (transition.action) {
+		case T__DO_IGNORE:
 			break;
 
-		case EPM_NORMAL:
-			epm_push(EPM_HALT_EMIT);
-			g_val = epm_cursor_inc();
+		case T__DO_KEY:
+			t__in_emit(T_POLL_CODE(0, ch), 0);
 			break;
 
-		case EPM_CONTROL:
-			epm_push(EPM_HALT_EMIT);
-			g_mod |= T_CONTROL;
-			g_val = epm_cursor_inc() | 0x40;
+		case T__DO_CONTROL:
+			t__in_emit(T_POLL_CODE(T_CONTROL, ch | 0x40), 0);
 			break;
 
-		/* escape sequence parser */
-		case EPM_ESCAPE:
-			g_is_escape = 1;
-			if (!available) {
-				g_val = '\x1b';
-				epm_push(EPM_HALT_EMIT);
-			}
-			else if (g_read_cursor[0] == '\x1b') {
-				g_val = '\x1b';
-				epm_push(EPM_HALT_EMIT);
-				epm_cursor_inc();
-			}
-			else if (g_read_cursor[0] == '\x4f') {
-				epm_push_init(EPM_SS3_FUNC);
-				epm_cursor_inc();
-			}
-			else if (g_read_cursor[0] == '[') {
-				epm_push_init(EPM_ESCAPE_BRACKET);
-				epm_cursor_inc();
-			}
-			else {
-				g_mod |= T_ALT;
-				g_val = epm_cursor_inc();
-				epm_push(EPM_HALT_EMIT);
-			}
+		case T__DO_ALT:
+			t__in_emit(T_POLL_CODE(T_ALT, ch), 0);
 			break;
 
-		case EPM_SS3_FUNC:
-			if (!available) {
-				g_val = '\x4f';
-				epm_push(EPM_HALT_EMIT);
-				epm_cursor_inc();
-			}
-			else {
-				g_mod |= T_SPECIAL;
-				g_val = epm_cursor_inc() - '\x4f';
-				epm_push(EPM_HALT_EMIT);
-			}
+		case T__DO_ALT_CONTROL:
+			t__in_emit(T_POLL_CODE(T_ALT | T_CONTROL, ch | 0x40), 0);
 			break;
 
-		case EPM_ESCAPE_BRACKET:
-			if (!available) {
-				g_mod |= T_ALT;
-				g_val = '[';
-				epm_push(EPM_HALT_EMIT);
-			}
-			/* @NOTE(max): we can't just follow EPM_PARAM -> M_INTER 
-			 * -> EPM_NORMAL because M_PARAM will emit a parameter 
-			 * even if there are none present, so we explicitly check 
-			 * for the required byte ranges. */
-			else if (0x30 <= g_read_cursor[0] &&
-			                 g_read_cursor[0] <= 0x3f) {
-				epm_push(EPM_PARAM);
-			}
-			else if (0x20 <= g_read_cursor[0] &&
-			                 g_read_cursor[0] <= 0x2f) {
-				epm_push(EPM_INTER);
-			}
-			else {
-				epm_push(EPM_NORMAL);
-			}
+		case T__DO_ESCAPE_KEY:
+			t__in_emit(T_POLL_CODE(T_CONTROL, '['), 0);
+			/* fall through */
+
+		case T__DO_BEGIN:
+			memset(g_params, 0, sizeof(g_params));
+			g_param_p = 0;
+			g_param_any = false;
+			g_inter_p = 0;
+			g_scratch_p = 0;
+			g_private = 0;
 			break;
 
-		/* parameter parser */
-		case EPM_PARAM:
-			if (!available) {
-				epm_push(code);
-				epm_push(EPM_HALT_IF_EMPTY);
-				epm_push(EPM_READ);
-			}
-			else if (g_read_cursor[0] < 0x30 ||
-			                       0x3f < g_read_cursor[0]) {
-				epm_push(EPM_INTER);
-				epm_push(EPM_PARAM_EMIT);
-			}
-			else if (g_read_cursor[0] == ';') {
-				epm_push(code);
-				epm_push(EPM_PARAM_EMIT);
-				epm_cursor_inc();
-			}
-			else {
-				epm_push(code);
-				if (g_scratch_p < T_SCRATCH_BUFSZ) {
-					g_scratch[g_scratch_p++] = epm_cursor_inc();
-				}
+		/* a DCS string (ESC P) only ever comes in as a reply, and is 
+		 * otherwise alt+shift+p; once asked, a reply that is late for
+		 * the query is still taken in up to its ST */
+		case T__DO_DCS_BEGIN:
+			if (!g_query_sent) {
+				t__in_emit(T_POLL_CODE(T_ALT, ch), 0);
+				state = T__STATE_GROUND;
 			}
 			break;
 
-		case EPM_PARAM_EMIT:
+		case T__DO_DIGIT:
 			if (g_param_p < T__PARAMS_MAX) {
-				uint16_t result = 0;
-				for (uint32_t i = 0; i < g_scratch_p; ++i) {
-					result *= 10;
-					result += g_scratch[i] - '0';
-				}
-				g_params [g_param_p++] = result;
-				g_scratch_p = 0;
+				u32 const value = g_params[g_param_p] * 10 + (ch - '0');
+				g_params[g_param_p] = MIN(value, UINT16_MAX);
 			}
+			g_param_any = true;
 			break;
 
-		/* intermediate bytes */
-		case EPM_INTER:
-			if (!available) {
-				epm_push(code);
-				epm_push(EPM_HALT_IF_EMPTY);
-				epm_push(EPM_READ);
-			}
-			else if (g_read_cursor[0] < 0x20 ||
-			                       0x2f < g_read_cursor[0]) {
-				epm_push(EPM_NORMAL);
-			}
-			else {
-				epm_push(code);
-				if (g_inter_p < T__INTERS_MAX) {
-					g_inters[g_inter_p++] = epm_cursor_inc();
-				}
+		case T__DO_SEP:
+			if (g_param_p < T__PARAMS_MAX) {
+				++g_param_p;
 			}
+			g_param_any = true;
 			break;
 
-		/* state updates */
-		case EPM_RESET:
-			g_code_p = 0;
-			g_param_p = 0;
-			g_inter_p = 0;
-			g_scratch_p = 0;
-			
-			g_mod = 0;
-			g_val = 0;
-			g_is_escape = 0;
+		case T__DO_PRIVATE:
+			/* private markers, only ever sent in replies */
+			g_private = ch;
+			break;
 
-			memset(g_params, 0, sizeof(g_params));
-			memset(g_inters, 0, sizeof(g_inters));
+		case T__DO_INTER:
+			if (g_inter_p < T__INTERS_MAX) {
+				g_inters[g_inter_p++] = ch;
+			}
+			break;
 
-			epm_push(EPM_DETERMINE);
+		case T__DO_CSI:
+			t__in_csi(ch);
 			break;
 
-		case EPM_READ:
-			g_read_buf_len = read(STDIN_FILENO, g_read_buf, sizeof(g_read_buf));
-			g_read_cursor = g_read_buf;
-			g_read_end = g_read_buf + g_read_buf_len;
+		case T__DO_SS3:
+			t__in_ss3(ch);
 			break;
 
-		/* terminating instructions */
-		case EPM_HALT_EMIT:
-			if (g_is_escape) {
-				uint32_t key_index = MIN(
-					g_params[0], ARRAY_LENGTH(g_pc_keyspec_table)
-				);
-				uint32_t mod_index = MIN(
-					g_params[1], ARRAY_LENGTH(g_pc_keymod_table)
-				);
-				if (g_val == '~') {
-					/* F5+ keys with modifiers */
-					g_val = g_pc_keyspec_table[key_index];
-				}
-				else if (0x50 <= g_val && g_val <= 0x54) {
-					/* F1-F4 keys with modifiers */
-					g_val -= 0x4f;
-				}
-				/* arrow keys are set so that g_val already has their code */
-				g_mod = T_SPECIAL | g_pc_keymod_table[mod_index];
+		case T__DO_DCS_PUT:
+			if (g_scratch_p < T_SCRATCH_BUFSZ) {
+				g_scratch[g_scratch_p++] = ch;
 			}
-			return T_POLL_CODE(g_mod, g_val);
+			break;
 
-		case EPM_HALT_UNKNOWN:
-			return T_POLL_CODE(T_ERROR, T_UNKNOWN);
+		case T__DO_DCS:
+			t__capabilities_reply_dcs();
+			break;
+		}
+	}
+
+	g_in_state = state;
+}
+
+/* Whether the decoder stopped right after the introducer of a sequence,
+ * which might just as well have been typed on its own. */
+static bool
+t__in_introduced()
+{
+	bool const bare = !g_param_any && !g_private && !g_inter_p;
+	switch (g_in_state) {
+	case T__STATE_ESCAPE:
+		return true;
+
+	case T__STATE_CSI_PARAM:
+	case T__STATE_SS3:
+		return bare;
+
+	case T__STATE_DCS:
+		return !g_scratch_p;
+	}
+	return false;
+}
+
+/* Once the input stayed dry for T_ESCAPE_TIMEOUT, a sequence that stopped
+ * right after its introducer was a key of its own. The rest of one that
+ * a read cut in two, reply or not, comes in well before then. */
+static void
+t__in_settle()
+{
+	if (!t__in_introduced()) {
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec + now.tv_nsec * 1e-9 - g_in_time < T_ESCAPE_TIMEOUT) {
+		return;
+	}
+
+	switch (g_in_state) {
+	case T__STATE_ESCAPE:
+		t__in_emit(T_POLL_CODE(T_CONTROL, '['), 0);
+		break;
+
+	case T__STATE_CSI_PARAM:
+		t__in_emit(T_POLL_CODE(T_ALT, '['), 0);
+		break;
+
+	case T__STATE_SS3:
+		t__in_emit(T_POLL_CODE(T_ALT, 'O'), 0);
+		break;
+
+	case T__STATE_DCS:
+		t__in_emit(T_POLL_CODE(T_ALT, 'P'), 0);
+		break;
+	}
+	g_in_state = T__STATE_GROUND;
+}
+
+/* Reads and decodes all the input there is room for, leaving enough 
+ * for every byte of a read to make an event. */
+static void
+t__in_read()
+{
+	if (!g_in_classes_ready) {
+		t__in_classes_init();
+	}
+
+	while (T_EVENTS_MAX - (g_events_tail - g_events_head) >= sizeof(g_read_buf)) {
+		/* stdin may share its file description with a non-blocking
+		 * stdout (see `T_OUTPUT_NONBLOCKING`) */
+		ssize_t const nread = g_in_fd < 0
+			? t__headless_read(g_read_buf, sizeof(g_read_buf))
+			: read(g_in_fd, g_read_buf, sizeof(g_read_buf));
+		if (nread <= 0) {
+			t__in_settle();
+			return;
+		}
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		g_in_time = now.tv_sec + now.tv_nsec * 1e-9;
+
+		t__in_decode(g_read_buf, nread);
+		if ((size_t) nread < sizeof(g_read_buf)) {
+			t__in_settle();
+			return;
+		}
+	}
+}
+
+u32
+t_poll_batch(struct t_event *events, u32 capacity)
+{
+	t__capabilities_tick();
+	t__in_read();
+
+	u32 count = 0;
+	while (count < capacity && g_events_head != g_events_tail) {
+		events[count++] = g_events[g_events_head++ & (T_EVENTS_MAX - 1)];
+	}
+	return count;
+}
+
+double
+t_input_timeout()
+{
+	if (!t__in_introduced()) {
+		return -1;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return MAX(g_in_time + T_ESCAPE_TIMEOUT - (now.tv_sec + now.tv_nsec * 1e-9), 0.0);
+}
+
+u32
+t_mouse_enable(bool all_motion)
+{
+	g_mouse_enabled = true;
+	return all_motion ? t_writez(T_MOUSE_ALL) : t_writez(T_MOUSE_BUTTONS);
+}
+
+u32
+t_mouse_disable()
+{
+	if (!g_mouse_enabled) {
+		return 0;
+	}
+	g_mouse_enabled = false;
+	return t_writez(T_MOUSE_OFF);
+}
+
+u16
+t_poll()
+{
+	/* reading only once everything read before is taken */
+	if (g_events_head == g_events_tail) {
+		t__capabilities_tick();
+		t__in_read();
+	}
+
+	if (g_events_head == g_events_tail) {
+		return T_POLL_CODE(T_ERROR, T_DISCARD);
+	}
+	return g_events[g_events_head++ & (T_EVENTS_MAX - 1)].code;
+}
+
+/* writev(2), accounting for it in the debug metrics if to the terminal,
+ * the sinks and the recording only count their bytes on their own */
+static inline ssize_t
+t__writev(s32 fd, struct iovec const *iov, u32 count)
+{
+#ifdef TC_DEBUG_METRICS
+	if (fd != g_out_fd) {
+		return writev(fd, iov, count);
+	}
+
+	u64 size = 0;
+	for (u32 i = 0; i < count; ++i) {
+		size += iov[i].iov_len;
+	}
+
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	ssize_t const written = fd < 0 
+		? t__headless_writev(iov, count) 
+		: writev(fd, iov, count);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	T__DEBUG_ADD(g_debug_nanos_blocked, 
+		(end.tv_sec - begin.tv_sec) * 1000000000ull + end.tv_nsec - begin.tv_nsec
+	);
+	T__DEBUG_ADD(g_debug_num_writes, 1);
+	if (written < (ssize_t) size) {
+		T__DEBUG_ADD(g_debug_num_short_writes, 1);
+	}
+	if (written > 0) {
+		T__DEBUG_ADD(g_debug_bytes_flushed, written);
+	}
+	return written;
+#else
+	return fd < 0 ? t__headless_writev(iov, count) : writev(fd, iov, count);
+#endif
+}
+
+/* Allocates the batch buffers, false if that failed. */
+static bool
+t__batches_init()
+{
+	for (u32 i = 0; i < T_WRITE_NBUFS; ++i) {
+		struct t__batch *batch = &g_batches[i];
+		if (batch->buffer) continue;
+
+		if (!(batch->buffer = malloc(T_WRITE_BUFSZ))) {
+			return false;
+		}
+		batch->capacity = T_WRITE_BUFSZ;
+	}
+
+	g_batch = &g_batches[g_write_index];
+	g_write_buf = g_batch->buffer;
+	g_write_cursor = g_write_buf;
+	g_write_end = g_write_buf + g_batch->capacity;
+	++g_write_epoch;
+	return true;
+}
+
+static void
+t__record_append(u8 const *data, u32 size);
+
+/* Keeps a copy of output about to be flushed for the sinks. */
+static void
+t__history_append(u8 const *data, u32 size)
+{
+	if (!g_num_sinks) {
+		return;
+	}
+
+	/* only the tail of what doesn't fit can matter */
+	if (size > T_SINK_HISTORY) {
+		g_history_head += size - T_SINK_HISTORY;
+		data += size - T_SINK_HISTORY;
+		size = T_SINK_HISTORY;
+	}
+
+	u32 const at = g_history_head % T_SINK_HISTORY;
+	u32 const first = MIN(size, T_SINK_HISTORY - at);
+	memcpy(g_history + at, data, first);
+	memcpy(g_history, data + first, size - first);
+	g_history_head += size;
+}
+
+/* Turns the open segment of the current batch into a closed one. */
+static void
+t__batch_close()
+{
+	struct t__batch *batch = g_batch;
+	u32 const cursor = g_write_cursor - g_write_buf;
+	if (cursor == batch->mark) {
+		return;
+	}
+	t__history_append(g_write_buf + batch->mark, cursor - batch->mark);
+	t__record_append(g_write_buf + batch->mark, cursor - batch->mark);
+	g_queued += cursor - batch->mark;
+
+	struct t__segment *last = batch->num_segments ? 
+		&batch->segments[batch->num_segments - 1] : NULL;
+	if (last && !last->data && last->offset + last->size == batch->mark) {
+		last->size += cursor - batch->mark;
+	}
+	else {
+		/* `t__splice` always leaves room for this one */
+		batch->segments[batch->num_segments++] = (struct t__segment) {
+			.offset = batch->mark,
+			.size = cursor - batch->mark,
+		};
+	}
+	batch->size += cursor - batch->mark;
+	batch->mark = cursor;
+}
+
+/* Queues `[data, data + size)` to be written out in place after what 
+ * has been written so far, the memory must stay valid until then. */
+static void
+t__splice(u8 const *data, u32 size)
+{
+	/* captures are handed out as a single piece, and never meant for
+	 * the sinks or the recording */
+	if (g_capturing) {
+		t_write(data, size);
+		return;
+	}
+	if (g_capture_only) {
+		return;
+	}
+
+	t__batch_close();
+
+	struct t__batch *batch = g_batch;
+	if (batch->num_segments + 2 > T_WRITE_SEGMENTS_MAX) {
+		t_write(data, size);
+		return;
+	}
+	batch->segments[batch->num_segments++] = (struct t__segment) {
+		.data = data,
+		.size = size,
+	};
+	batch->size += size;
+	t__history_append(data, size);
+	t__record_append(data, size);
+	g_queued += size;
+	T__DEBUG_ADD(g_debug_bytes_buffered, size);
+}
+
+/* Accounts for queued bytes that are not referenced anymore. */
+static inline void
+t__release(u64 size)
+{
+	__atomic_fetch_add(&g_released, size, __ATOMIC_RELEASE);
+}
+
+static void
+t__batch_reset(struct t__batch *batch)
+{
+	batch->mark = 0;
+	batch->num_segments = 0;
+	batch->size = 0;
+	batch->trace = 0;
+}
+
+/* Gathers the segments of `batch` into `iov`, returning the count. */
+static u32
+t__batch_gather(struct t__batch const *batch, struct iovec *iov)
+{
+	for (u32 i = 0; i < batch->num_segments; ++i) {
+		struct t__segment const *segment = &batch->segments[i];
+		iov[i].iov_base = (void *) (segment->data ? 
+			segment->data : batch->buffer + segment->offset);
+		iov[i].iov_len = segment->size;
+	}
+	return batch->num_segments;
+}
+
+/* Drops the first `size` bytes worth of segments from `batch`. */
+static void
+t__batch_consume(struct t__batch *batch, u32 size)
+{
+	u32 done = 0;
+	while (done < batch->num_segments && 
+	       size >= batch->segments[done].size) 
+	{
+		size -= batch->segments[done].size;
+		batch->size -= batch->segments[done].size;
+		++done;
+	}
+
+	if (done < batch->num_segments && size) {
+		struct t__segment *segment = &batch->segments[done];
+		if (segment->data) segment->data += size;
+		else segment->offset += size;
+		segment->size -= size;
+		batch->size -= size;
+	}
+
+	batch->num_segments -= done;
+	memmove(
+		batch->segments, 
+		batch->segments + done, 
+		batch->num_segments * sizeof(struct t__segment)
+	);
+}
+
+/* The latency bucket of `micros`, see T__LATENCY_BUCKETS. */
+static inline u32
+t__latency_bucket(u64 micros)
+{
+	if (micros < T__LATENCY_SUBS) {
+		return micros;
+	}
+	u32 const shift = 63 - __builtin_clzll(micros) - T__LATENCY_SUB_BITS;
+	return (shift + 1) * T__LATENCY_SUBS + ((micros >> shift) & (T__LATENCY_SUBS - 1));
+}
+
+/* Records the time since the input read at `since` as shown, from the
+ * main or the writer thread. */
+static void
+t__latency_record(double since)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double const seconds = now.tv_sec + now.tv_nsec * 1e-9 - since;
+
+	u64 micros = seconds > 0 ? (u64) (seconds * 1e6) : 0;
+	if (micros > UINT32_MAX) {
+		micros = UINT32_MAX;
+	}
+	__atomic_fetch_add(&g_latency_counts[t__latency_bucket(micros)], 1, __ATOMIC_RELAXED);
+
+	u64 max = __atomic_load_n(&g_latency_max, __ATOMIC_RELAXED);
+	while (micros > max && !__atomic_compare_exchange_n(&g_latency_max, 
+		&max, micros, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* writev(2) the whole batch, retrying after interruptions and short
+ * writes. */
+static bool
+t__batch_write_all(s32 fd, struct t__batch *batch)
+{
+	struct iovec iov[T_WRITE_SEGMENTS_MAX];
+	u32 const size = batch->size;
+	bool ok = true;
+
+	while (batch->num_segments) {
+		u32 const count = t__batch_gather(batch, iov);
+		ssize_t const written = t__writev(fd, iov, count);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			ok = false;
+			break;
+		}
+		t__batch_consume(batch, written);
+	}
+
+	if (ok && batch->trace) {
+		t__latency_record(batch->trace);
+	}
+
+	/* whatever is left is dropped by the caller */
+	t__release(size);
+	return ok;
+}
+
+/* Grows the current batch buffer to have room for `size` more bytes. */
+static bool
+t__batch_grow(u32 size)
+{
+	struct t__batch *batch = g_batch;
+	u32 const cursor = g_write_cursor - g_write_buf;
+	if ((u64) cursor + size > T_WRITE_BUFSZ_MAX) {
+		return false;
+	}
+	u32 const capacity = MIN(MAX(batch->capacity * 2ull, (u64) cursor + size), 
+		T_WRITE_BUFSZ_MAX
+	);
+
+	u8 *buffer = realloc(batch->buffer, capacity);
+	if (!buffer) {
+		return false;
+	}
+	batch->buffer = buffer;
+	batch->capacity = capacity;
+
+	g_write_buf = buffer;
+	g_write_cursor = buffer + cursor;
+	g_write_end = buffer + capacity;
+	++g_write_epoch;
+	return true;
+}
+
+static void *
+t__writer_main(void *opaque)
+{
+	UNUSED(opaque);
+
+	pthread_mutex_lock(&g_writer_lock);
+	for (;;) {
+		while (!g_writer_queued && g_writer_running) {
+			pthread_cond_wait(&g_writer_wake, &g_writer_lock);
+		}
+		/* drain everything before stopping */
+		if (!g_writer_queued) {
+			break;
+		}
+
+		/* work on a copy, `t_backlog` reads the queued sizes */
+		struct t__batch *batch = &g_batches[g_writer_head];
+		struct t__batch pending = *batch;
+		pthread_mutex_unlock(&g_writer_lock);
+
+		bool const ok = t__batch_write_all(g_out_fd, &pending);
+
+		pthread_mutex_lock(&g_writer_lock);
+		g_writer_failed |= !ok;
+		t__batch_reset(batch);
+		g_writer_head = (g_writer_head + 1) % T_WRITE_NBUFS;
+		--g_writer_queued;
+		pthread_cond_signal(&g_writer_done);
+	}
+	pthread_mutex_unlock(&g_writer_lock);
+
+	return NULL;
+}
+
+/* Puts the output back to blocking on the way out, however that goes:
+ * stdout usually shares its file description with stdin, and neither is
+ * expected to be left non-blocking. */
+static void
+t__nonblocking_restore()
+{
+	if (g_output_mode == T_OUTPUT_NONBLOCKING) {
+		fcntl(g_out_fd, F_SETFL, g_stdout_flags);
+	}
+}
+
+/* Hands the current batch over to the writer thread and moves on to 
+ * the next one, waiting for it to be written out if necessary. */
+static u32
+t__flush_threaded()
+{
+	u32 const size = g_batches[g_write_index].size;
+
+	pthread_mutex_lock(&g_writer_lock);
+
+	if (g_writer_failed) {
+		pthread_mutex_unlock(&g_writer_lock);
+		t__release(size);
+		t__batch_reset(&g_batches[g_write_index]);
+		g_write_cursor = g_write_buf;
+		++g_write_epoch;
+		return 0;
+	}
+
+	++g_writer_queued;
+	pthread_cond_signal(&g_writer_wake);
+
+	while (g_writer_queued >= T_WRITE_NBUFS) {
+		pthread_cond_wait(&g_writer_done, &g_writer_lock);
+	}
+	pthread_mutex_unlock(&g_writer_lock);
+
+	g_write_index = (g_write_index + 1) % T_WRITE_NBUFS;
+	g_batch = &g_batches[g_write_index];
+	g_write_buf = g_batch->buffer;
+	g_write_cursor = g_write_buf;
+	g_write_end = g_write_buf + g_batch->capacity;
+	++g_write_epoch;
+	return size;
+}
+
+/* Writes out as much of the batch as the terminal takes, waiting for it 
+ * to take everything only if `wait`, and moves whatever is left of the 
+ * buffer to its front. */
+static u32
+t__flush_nonblocking(bool wait)
+{
+	struct t__batch *batch = &g_batches[g_write_index];
+	struct iovec iov[T_WRITE_SEGMENTS_MAX];
+	u32 total = 0;
+
+	while (batch->num_segments) {
+		u32 const count = t__batch_gather(batch, iov);
+		ssize_t const written = t__writev(g_out_fd, iov, count);
+
+		if (written >= 0) {
+			t__batch_consume(batch, written);
+			t__release(written);
+			total += written;
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			if (!wait) break;
+
+			struct pollfd pfd = { .fd = g_out_fd, .events = POLLOUT };
+			poll(&pfd, 1, -1);
+		}
+		else if (errno != EINTR) {
+			/* @TODO(max): log or something? who close the damn stream */
+			t__release(batch->size);
+			t__batch_reset(batch);
+			break;
+		}
+	}
+
+	/* all of it taken, including the frame that was traced */
+	if (!batch->num_segments && batch->trace) {
+		t__latency_record(batch->trace);
+		batch->trace = 0;
+	}
+
+	/* the oldest byte still needed is the first one inside the buffer */
+	u32 origin = batch->mark;
+	for (u32 i = 0; i < batch->num_segments; ++i) {
+		if (!batch->segments[i].data) {
+			origin = batch->segments[i].offset;
+			break;
+		}
+	}
+
+	if (origin) {
+		u32 const cursor = g_write_cursor - g_write_buf;
+		memmove(g_write_buf, g_write_buf + origin, cursor - origin);
+		for (u32 i = 0; i < batch->num_segments; ++i) {
+			if (!batch->segments[i].data) {
+				batch->segments[i].offset -= origin;
+			}
+		}
+		batch->mark -= origin;
+		g_write_cursor -= origin;
+		++g_write_epoch;
+	}
+	return total;
+}
+
+/* Frees up room for at least `size` bytes in a full write buffer (or
+ * just some room outside a frame), false if that failed. */
+static bool
+t__make_room(u32 size)
+{
+	if (!g_write_buf) {
+		/* threads that only capture have nowhere else to write to */
+		return !g_capture_only && t__batches_init();
+	}
+
+	/* never cut a frame (or capture) short */
+	if (g_capturing) {
+		g_capture_short |= !t__batch_grow(size);
+		return !g_capture_short;
+	}
+	if (g_frame_open) {
+		return t__batch_grow(size);
+	}
+
+	if (g_output_mode == T_OUTPUT_NONBLOCKING) {
+		/* the terminal gets what it takes and the rest is kept for
+		 * later, waiting on it is what the mode is there to avoid */
+		t__batch_close();
+		t__flush_nonblocking(false);
+		if ((u32) (g_write_end - g_write_cursor) >= size) {
+			return true;
+		}
+		return t__batch_grow(size);
+	}
+	return t_flush() > 0;
+}
+
+bool
+t_output_mode_set(enum t_output_mode mode)
+{
+	if (mode == g_output_mode) {
+		return true;
+	}
+
+	/* go back to direct output first */
+	switch (g_output_mode) {
+	case T_OUTPUT_DIRECT:
+		break;
+
+	case T_OUTPUT_THREADED:
+		/* let the writer drain whatever was handed over */
+		pthread_mutex_lock(&g_writer_lock);
+		g_writer_running = false;
+		pthread_cond_signal(&g_writer_wake);
+		pthread_mutex_unlock(&g_writer_lock);
+		pthread_join(g_writer, NULL);
+		break;
+
+	case T_OUTPUT_NONBLOCKING:
+		t__flush_nonblocking(true);
+		fcntl(g_out_fd, F_SETFL, g_stdout_flags);
+		break;
+	}
+	g_output_mode = T_OUTPUT_DIRECT;
+
+	/* headless output kept in memory is only ever appended to by
+	 * the calling thread */
+	if (g_out_fd < 0 && mode != T_OUTPUT_DIRECT) {
+		return false;
+	}
+
+	switch (mode) {
+	case T_OUTPUT_DIRECT:
+		break;
+
+	case T_OUTPUT_THREADED:
+		if (!g_write_buf && !t__batches_init()) {
+			return false;
+		}
+		g_writer_running = true;
+		g_writer_failed = false;
+		g_writer_head = g_write_index;
+		g_writer_queued = 0;
+		if (pthread_create(&g_writer, NULL, t__writer_main, NULL) != 0) {
+			g_writer_running = false;
+			return false;
+		}
+		break;
+
+	case T_OUTPUT_NONBLOCKING: {
+		static bool l_restore_registered;
+		if (!l_restore_registered) {
+			l_restore_registered = atexit(t__nonblocking_restore) == 0;
+		}
+
+		if ((g_stdout_flags = fcntl(g_out_fd, F_GETFL)) < 0 ||
+		    fcntl(g_out_fd, F_SETFL, g_stdout_flags | O_NONBLOCK) < 0)
+		{
+			return false;
+		}
+		break;
+	}
+	}
+
+	g_output_mode = mode;
+	return true;
+}
+
+enum t_output_mode
+t_output_mode()
+{
+	return g_output_mode;
+}
+
+u32
+t_backlog()
+{
+	switch (g_output_mode) {
+	case T_OUTPUT_THREADED: {
+		u32 backlog = 0;
+		pthread_mutex_lock(&g_writer_lock);
+		for (u32 i = 0; i < g_writer_queued; ++i) {
+			backlog += g_batches[(g_writer_head + i) % T_WRITE_NBUFS].size;
+		}
+		pthread_mutex_unlock(&g_writer_lock);
+		return backlog;
+	}
+
+	case T_OUTPUT_NONBLOCKING:
+		return g_batches[g_write_index].size;
+
+	case T_OUTPUT_DIRECT:
+	default:
+		return 0;
+	}
+}
+
+static void
+t__sinks_service();
+
+static void
+t__record_event();
+
+u32
+t_flush()
+{
+	if (g_frame_open || g_capturing) {
+		return 0;
+	}
+
+	/* the sinks are fed from the history as the batch is closed */
+	t__batch_close();
+	t__sinks_service();
+	t__record_event();
+
+	struct t__batch *batch = &g_batches[g_write_index];
+	u32 const size = batch->size;
+	if (!size) {
+		return 0;
+	}
+
+	if (g_output_mode == T_OUTPUT_THREADED) {
+		return t__flush_threaded();
+	}
+
+	if (g_output_mode == T_OUTPUT_NONBLOCKING) {
+		return t__flush_nonblocking(false);
+	}
+
+	bool const ok = t__batch_write_all(g_out_fd, batch);
+	t__batch_reset(batch);
+	g_write_cursor = g_write_buf;
+	++g_write_epoch;
+	if (!ok) {
+		/* @TODO(max): log or something? who close the damn stream */
+		return 0;
+	}
+	return size;
+}
+
+void
+t_drain()
+{
+	if (g_frame_open || g_capturing) {
+		return;
+	}
+	t_flush();
+
+	switch (g_output_mode) {
+	case T_OUTPUT_DIRECT:
+		break;
+
+	case T_OUTPUT_THREADED:
+		pthread_mutex_lock(&g_writer_lock);
+		while (g_writer_queued) {
+			pthread_cond_wait(&g_writer_done, &g_writer_lock);
+		}
+		pthread_mutex_unlock(&g_writer_lock);
+		break;
+
+	case T_OUTPUT_NONBLOCKING:
+		t__flush_nonblocking(true);
+		break;
+	}
+}
+
+void
+t_frame_begin()
+{
+	if (g_frame_open) {
+		return;
+	}
+	g_frame_open = true;
+
+	/* DECSET 2026, the terminal holds off rendering until the matching
+	 * reset so the frame never shows half-drawn */
+	g_frame_synced = g_capabilities & T_CAP_SYNC;
+	if (g_frame_synced) {
+		t__splice((u8 const *) T_SYNC_BEGIN, sizeof(T_SYNC_BEGIN) - 1);
+	}
+
+	t__batch_close();
+	g_frame_queued = g_queued;
+}
+
+u32
+t_frame_commit()
+{
+	if (g_frame_open) {
+		/* the input traced so far is shown by this frame, unless it
+		 * changes nothing */
+		t__batch_close();
+		if (g_latency_pending && g_queued != g_frame_queued) {
+			if (!g_batch->trace) {
+				g_batch->trace = g_latency_pending;
+			}
+		}
+		g_latency_pending = 0;
+
+		if (g_frame_synced) {
+			t__splice((u8 const *) T_SYNC_END, sizeof(T_SYNC_END) - 1);
+		}
+	}
+	g_frame_open = false;
+
+	return t_flush();
+}
+
+void
+t_latency_trace(double time)
+{
+	if (!g_latency_pending || time < g_latency_pending) {
+		g_latency_pending = time;
+	}
+}
+
+/* The highest value in latency bucket `index`, in microseconds. */
+static u64
+t__latency_bucket_high(u32 index)
+{
+	if (index < T__LATENCY_SUBS) {
+		return index;
+	}
+	u32 const shift = index / T__LATENCY_SUBS - 1;
+	u64 const low = (u64) (T__LATENCY_SUBS + index % T__LATENCY_SUBS) << shift;
+	return low + ((u64) 1 << shift) - 1;
+}
+
+void
+t_latency(struct t_latency *out)
+{
+	u64 counts [T__LATENCY_BUCKETS];
+	u64 count = 0;
+	for (u32 i = 0; i < T__LATENCY_BUCKETS; ++i) {
+		counts[i] = __atomic_load_n(&g_latency_counts[i], __ATOMIC_RELAXED);
+		count += counts[i];
+	}
+	u64 const max = __atomic_load_n(&g_latency_max, __ATOMIC_RELAXED);
+
+	/* the percentiles by rank, no further than the exact maximum */
+	u64 const percents [2] = { 50, 99 };
+	u64 found [2] = {0};
+	for (u32 q = 0; q < 2 && count; ++q) {
+		u64 const rank = (count * percents[q] + 99) / 100;
+		u64 seen = 0;
+		for (u32 i = 0; i < T__LATENCY_BUCKETS; ++i) {
+			seen += counts[i];
+			if (seen >= rank) {
+				found[q] = MIN(t__latency_bucket_high(i), max);
+				break;
+			}
+		}
+	}
+
+	out->count = count;
+	out->p50 = found[0] * 1e-6;
+	out->p99 = found[1] * 1e-6;
+	out->max = max * 1e-6;
+}
+
+bool
+t_capture_begin()
+{
+	if (g_capturing) {
+		return false;
+	}
+
+	if (!g_capture.buffer) {
+		if (!(g_capture.buffer = malloc(T_WRITE_BUFSZ))) {
+			return false;
+		}
+		g_capture.capacity = T_WRITE_BUFSZ;
+	}
+
+	g_capture_saved_batch = g_batch;
+	g_capture_saved_buf = g_write_buf;
+	g_capture_saved_cursor = g_write_cursor;
+	g_capture_saved_end = g_write_end;
+
+	t__batch_reset(&g_capture);
+	g_batch = &g_capture;
+	g_write_buf = g_capture.buffer;
+	g_write_cursor = g_write_buf;
+	g_write_end = g_write_buf + g_capture.capacity;
+	g_capturing = true;
+	g_capture_short = false;
+	++g_write_epoch;
+	return true;
+}
+
+u8 const *
+t_capture_end(u32 *out_size)
+{
+	if (!g_capturing) {
+		*out_size = 0;
+		return NULL;
+	}
+
+	/* the buffer may have grown (and moved) meanwhile */
+	u8 const *captured = g_capture.buffer;
+	*out_size = g_write_cursor - g_write_buf;
+
+	g_batch = g_capture_saved_batch;
+	g_write_buf = g_capture_saved_buf;
+	g_write_cursor = g_capture_saved_cursor;
+	g_write_end = g_capture_saved_end;
+	g_capturing = false;
+	++g_write_epoch;
+
+	if (g_capture_short) {
+		*out_size = 0;
+		return NULL;
+	}
+	return captured;
+}
+
+bool
+t_capturing()
+{
+	return g_capturing;
+}
+
+void
+t_capture_thread()
+{
+	if (g_capturing) {
+		return;
+	}
+	g_capture_only = true;
+	g_batch = &g_capture;
+	g_write_buf = NULL;
+	g_write_cursor = NULL;
+	g_write_end = NULL;
+	++g_write_epoch;
+}
+
+void
+t_capture_free()
+{
+	if (g_capturing) {
+		return;
+	}
+	free(g_capture.buffer);
+	g_capture = (struct t__batch) {0};
+}
+
+u64
+t_splice(u8 const *data, u32 size)
+{
+	t__splice(data, size);
+	return g_capturing ? 0 : g_queued;
+}
+
+u64
+t_released()
+{
+	return __atomic_load_n(&g_released, __ATOMIC_ACQUIRE);
+}
+
+struct t_write_mark
+t_write_mark()
+{
+	return (struct t_write_mark) {
+		.at = g_write_cursor,
+		.epoch = g_write_epoch,
+	};
+}
+
+u8 const *
+t_written_since(struct t_write_mark mark, u32 *out_size)
+{
+	if (!mark.at || mark.epoch != g_write_epoch) {
+		*out_size = 0;
+		return NULL;
+	}
+	*out_size = g_write_cursor - mark.at;
+	return mark.at;
+}
+
+/* @SECTION(sinks) */
+static void
+t__sink_release(struct t__sink *sink)
+{
+	free(sink->repaint);
+	sink->repaint = NULL;
+	sink->repaint_size = 0;
+	sink->repaint_sent = 0;
+}
+
+/* Writes out as much as the sink takes without blocking. */
+static void
+t__sink_service(struct t__sink *sink)
+{
+	if (g_history_head - sink->position > T_SINK_HISTORY) {
+		/* the history moved on without it */
+		t__sink_release(sink);
+		sink->resync = true;
+	}
+	if (sink->resync) {
+		return;
+	}
+
+	for (;;) {
+		struct iovec iov [3];
+		u32 count = 0;
+
+		if (sink->repaint_sent < sink->repaint_size) {
+			iov[count].iov_base = sink->repaint + sink->repaint_sent;
+			iov[count].iov_len = sink->repaint_size - sink->repaint_sent;
+			++count;
+		}
+
+		u32 const at = sink->position % T_SINK_HISTORY;
+		u32 const pending = g_history_head - sink->position;
+		u32 const first = MIN(pending, T_SINK_HISTORY - at);
+		if (first) {
+			iov[count].iov_base = g_history + at;
+			iov[count].iov_len = first;
+			++count;
+		}
+		if (pending > first) {
+			iov[count].iov_base = g_history;
+			iov[count].iov_len = pending - first;
+			++count;
+		}
+
+		if (!count) {
+			break;
+		}
+
+		ssize_t written = t__writev(sink->fd, iov, count);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+			/* gone, for ex. the other end of a pty was closed */
+			t_sink_detach(sink - g_sinks);
+			break;
+		}
+		T__DEBUG_ADD(g_debug_bytes_sunk, written);
+
+		u32 const repaint = MIN((u32) written, sink->repaint_size - sink->repaint_sent);
+		sink->repaint_sent += repaint;
+		sink->position += written - repaint;
+		if (sink->repaint && sink->repaint_sent == sink->repaint_size) {
+			t__sink_release(sink);
+		}
+	}
+}
+
+static void
+t__sinks_service()
+{
+	for (u32 i = 0; i < T_SINKS_MAX; ++i) {
+		if (g_sinks[i].attached) {
+			t__sink_service(&g_sinks[i]);
+		}
+	}
+}
+
+/* Puts the sinks back to blocking on the way out, however that goes, as
+ * their file descriptions may be shared with others. */
+static void
+t__sinks_restore()
+{
+	for (u32 i = 0; i < T_SINKS_MAX; ++i) {
+		if (g_sinks[i].attached) {
+			fcntl(g_sinks[i].fd, F_SETFL, g_sinks[i].flags);
+		}
+	}
+}
+
+s32
+t_sink_attach(s32 fd)
+{
+	if (!g_history && !(g_history = malloc(T_SINK_HISTORY))) {
+		return -1;
+	}
+
+	static bool l_restore_registered;
+	if (!l_restore_registered) {
+		l_restore_registered = atexit(t__sinks_restore) == 0;
+	}
+
+	for (u32 i = 0; i < T_SINKS_MAX; ++i) {
+		struct t__sink *sink = &g_sinks[i];
+		if (sink->attached) continue;
+
+		/* a slow sink must never hold up the others */
+		if ((sink->flags = fcntl(fd, F_GETFL)) < 0 ||
+		    fcntl(fd, F_SETFL, sink->flags | O_NONBLOCK) < 0)
+		{
+			return -1;
+		}
+
+		/* a sink going away shows up as EPIPE rather than killing us */
+		signal(SIGPIPE, SIG_IGN);
+
+		*sink = (struct t__sink) {
+			.fd = fd,
+			.flags = sink->flags,
+			.attached = true,
+			.resync = true, /* it shows nothing yet */
+			.position = g_history_head,
+		};
+		++g_num_sinks;
+		return i;
+	}
+	return -1;
+}
+
+void
+t_sink_detach(s32 id)
+{
+	if (id < 0 || T_SINKS_MAX <= id || !g_sinks[id].attached) {
+		return;
+	}
+
+	struct t__sink *sink = &g_sinks[id];
+	fcntl(sink->fd, F_SETFL, sink->flags);
+	t__sink_release(sink);
+	sink->attached = false;
+	--g_num_sinks;
+}
+
+s32
+t_sink_resync_wanted()
+{
+	for (u32 i = 0; i < T_SINKS_MAX; ++i) {
+		if (g_sinks[i].attached && g_sinks[i].resync) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void
+t_sink_resync(s32 id, u8 const *data, u32 size)
+{
+	if (id < 0 || T_SINKS_MAX <= id || !g_sinks[id].attached) {
+		return;
+	}
+
+	struct t__sink *sink = &g_sinks[id];
+	t__sink_release(sink);
+
+	/* the sink may have stopped in the middle of a sequence, which CAN
+	 * aborts (and is ignored otherwise) */
+	if (!(sink->repaint = malloc(1 + size))) {
+		return;
+	}
+	sink->repaint[0] = '\x18';
+	if (size) {
+		memcpy(sink->repaint + 1, data, size);
+	}
+	sink->repaint_size = 1 + size;
+	sink->position = g_history_head;
+	sink->resync = false;
+
+	t__sink_service(sink);
+}
+
+/* @SECTION(record) */
+static double
+t__record_now()
+{
+	if (g_record_clock) {
+		return g_record_clock();
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/* write(2)s everything, false if that failed. */
+static bool
+t__record_write(char const *data, u32 size)
+{
+	while (size) {
+		struct iovec const iov = { .iov_base = (void *) data, .iov_len = size };
+		ssize_t const written = t__writev(g_record_fd, &iov, 1);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		T__DEBUG_ADD(g_debug_bytes_recorded, written);
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+/* Makes room for `size` more bytes in the event of this flush, keeping
+ * the buffer for the next ones. */
+static bool
+t__record_reserve(u32 size)
+{
+	if (g_record_event_capacity - g_record_event_size >= size) {
+		return true;
+	}
+
+	u64 const capacity = MAX(g_record_event_capacity * 2ull, 
+		(u64) g_record_event_size + size
+	);
+	char *event = capacity <= UINT32_MAX ? realloc(g_record_event, capacity) : NULL;
+	if (!event) {
+		return false;
+	}
+	g_record_event = event;
+	g_record_event_capacity = capacity;
+	return true;
+}
+
+/* Escapes control character `c`. */
+static inline char *
+t__record_escape(char *cursor, u8 c)
+{
+	static char const l_hex [] = "0123456789abcdef";
+
+	*cursor++ = '\\';
+	*cursor++ = 'u';
+	*cursor++ = '0';
+	*cursor++ = '0';
+	*cursor++ = l_hex[c >> 4];
+	*cursor++ = l_hex[c & 0xf];
+	return cursor;
+}
+
+/* Stands in for bytes that are not UTF-8 with U+FFFD, as asciinema 
+ * does. */
+static inline char *
+t__record_replace(char *cursor)
+{
+	*cursor++ = '\xef';
+	*cursor++ = '\xbf';
+	*cursor++ = '\xbd';
+	return cursor;
+}
+
+/* Replaces the bytes held back as the start of a UTF-8 sequence, which
+ * turned out not to be one (or the recording stops in the middle). */
+static char *
+t__record_release_utf8(char *cursor)
+{
+	if (g_record_utf8_size) {
+		cursor = t__record_replace(cursor);
+	}
+	g_record_utf8_size = 0;
+	g_record_utf8_need = 0;
+	return cursor;
+}
+
+/* Adds output about to be flushed to the event of this flush, escaped
+ * as a JSON string: valid UTF-8 goes in as it is, anything else past
+ * ASCII as U+FFFD. A sequence cut short by a flush is held back until 
+ * the rest of it comes along. */
+static void
+t__record_append(u8 const *data, u32 size)
+{
+	if (g_record_fd < 0) {
+		return;
+	}
+
+	for (u32 i = 0; i < size; ++i) {
+		/* one byte at a time (with as many held back), the buffer only
+		 * grows as far as the output actually takes */
+		if (g_record_event_capacity - g_record_event_size < 32 && !t__record_reserve(32)) {
+			/* a recording with holes is no good */
+			t_record_stop();
+			return;
+		}
 
-		case EPM_HALT_IF_EMPTY:
-			if (!available) {
-				return T_POLL_CODE(T_ERROR, T_DISCARD);
+		char *cursor = g_record_event + g_record_event_size;
+		u8 const c = data[i];
+
+		if (g_record_utf8_need) {
+			/* the second byte also rules out overlong forms, surrogates
+			 * and code points past U+10FFFF */
+			u8 const lead = g_record_utf8[0];
+			bool const second = g_record_utf8_size == 1;
+			u8 const low = 
+				second && lead == 0xe0 ? 0xa0 : 
+				second && lead == 0xf0 ? 0x90 : 0x80;
+			u8 const high = 
+				second && lead == 0xed ? 0x9f : 
+				second && lead == 0xf4 ? 0x8f : 0xbf;
+
+			if (low <= c && c <= high) {
+				g_record_utf8[g_record_utf8_size++] = c;
+				if (g_record_utf8_size == g_record_utf8_need) {
+					memcpy(cursor, g_record_utf8, g_record_utf8_size);
+					cursor += g_record_utf8_size;
+					g_record_utf8_size = 0;
+					g_record_utf8_need = 0;
+				}
+				g_record_event_size = cursor - g_record_event;
+				continue;
 			}
+			cursor = t__record_release_utf8(cursor);
+		}
+
+		if (c == '"' || c == '\\') {
+			*cursor++ = '\\';
+			*cursor++ = c;
+		}
+		else if (0x20 <= c && c < 0x7f) {
+			*cursor++ = c;
+		}
+		else if (0xc2 <= c && c <= 0xf4) {
+			g_record_utf8[0] = c;
+			g_record_utf8_size = 1;
+			g_record_utf8_need = c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+		}
+		else if (c >= 0x80) {
+			cursor = t__record_replace(cursor);
+		}
+		else {
+			cursor = t__record_escape(cursor, c);
+		}
+		g_record_event_size = cursor - g_record_event;
+	}
+}
+
+static void *
+t__recorder_main(void *opaque)
+{
+	UNUSED(opaque);
+
+	/* the events being written, swapped with the queue each time */
+	char *events = NULL;
+	u32 capacity = 0;
+
+	pthread_mutex_lock(&g_recorder_lock);
+	for (;;) {
+		while (!g_record_queue_size && g_recorder_running) {
+			pthread_cond_wait(&g_recorder_wake, &g_recorder_lock);
+		}
+		/* write out everything before stopping */
+		if (!g_record_queue_size) {
+			break;
 		}
+
+		char *const taken = g_record_queue;
+		u32 const taken_capacity = g_record_queue_capacity;
+		u32 const size = g_record_queue_size;
+		g_record_queue = events;
+		g_record_queue_capacity = capacity;
+		g_record_queue_size = 0;
+		events = taken;
+		capacity = taken_capacity;
+		pthread_mutex_unlock(&g_recorder_lock);
+
+		bool const ok = t__record_write(events, size);
+
+		pthread_mutex_lock(&g_recorder_lock);
+		g_recorder_failed |= !ok;
 	}
+	pthread_mutex_unlock(&g_recorder_lock);
 
-	/* @TODO(max): should not happen, log? */
-	return 0;
+	free(events);
+	return NULL;
 }
 
-u32
-t_flush()
+/* Queues the event of this flush for the recorder, if there was any 
+ * output. */
+static void
+t__record_event()
 {
-	u32 const limit = g_write_cursor - g_write_buf;
+	if (g_record_fd < 0 || !g_record_event_size) {
+		return;
+	}
 
-	if (limit && write(STDOUT_FILENO, g_write_buf, limit) < 0) {
-		/* @TODO(max): log or something? who close the damn stream */
-		return 0;
+	char head [64];
+	s32 const head_size = snprintf(head, sizeof(head), "[%.6f, \"o\", \"", 
+		MAX(t__record_now() - g_record_start, 0.0)
+	);
+	u32 const size = g_record_event_size;
+	g_record_event_size = 0;
+
+	pthread_mutex_lock(&g_recorder_lock);
+
+	u64 const needed = (u64) g_record_queue_size + head_size + size + 3;
+	bool ok = !g_recorder_failed && needed <= T_RECORD_QUEUE_MAX;
+	if (ok && needed > g_record_queue_capacity) {
+		u64 const capacity = MAX(g_record_queue_capacity * 2ull, needed);
+		char *queue = realloc(g_record_queue, capacity);
+		ok = queue != NULL;
+		if (ok) {
+			g_record_queue = queue;
+			g_record_queue_capacity = capacity;
+		}
+	}
+	if (ok) {
+		char *cursor = g_record_queue + g_record_queue_size;
+		memcpy(cursor, head, head_size);
+		memcpy(cursor + head_size, g_record_event, size);
+		memcpy(cursor + head_size + size, "\"]\n", 3);
+		g_record_queue_size = needed;
+		pthread_cond_signal(&g_recorder_wake);
 	}
 
-	g_write_cursor = g_write_buf;
-	return limit;
+	pthread_mutex_unlock(&g_recorder_lock);
+
+	if (!ok) {
+		/* the disk fell too far behind, or failed */
+		t_record_stop();
+	}
+}
+
+bool
+t_record_start(s32 fd, double (*clock)())
+{
+	t_record_stop();
+
+	s32 w, h;
+	t_query_size(&w, &h);
+
+	char header [128];
+	s32 const header_size = snprintf(header, sizeof(header),
+		"{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %lld}\n",
+		w, h, (long long) time(NULL)
+	);
+
+	/* whatever is buffered already goes out unrecorded */
+	t_flush();
+
+	g_record_fd = fd;
+	g_record_clock = clock;
+	g_record_start = t__record_now();
+	g_record_event_size = 0;
+	g_record_utf8_size = 0;
+	g_record_utf8_need = 0;
+
+	g_recorder_running = true;
+	g_recorder_failed = false;
+	g_record_queue_size = 0;
+	if (!t__record_write(header, header_size) ||
+	    pthread_create(&g_recorder, NULL, t__recorder_main, NULL) != 0)
+	{
+		g_recorder_running = false;
+		g_record_fd = -1;
+		return false;
+	}
+	return true;
+}
+
+void
+t_record_stop()
+{
+	if (g_record_fd < 0) {
+		return;
+	}
+
+	/* the start of a sequence that never ended */
+	if (g_record_utf8_size && t__record_reserve(24)) {
+		char *cursor = t__record_release_utf8(g_record_event + g_record_event_size);
+		g_record_event_size = cursor - g_record_event;
+	}
+
+	/* which stops the recording itself if it can't be queued */
+	t__record_event();
+	if (g_record_fd < 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&g_recorder_lock);
+	g_recorder_running = false;
+	pthread_cond_signal(&g_recorder_wake);
+	pthread_mutex_unlock(&g_recorder_lock);
+	pthread_join(g_recorder, NULL);
+	g_record_fd = -1;
+
+	free(g_record_event);
+	g_record_event = NULL;
+	g_record_event_size = 0;
+	g_record_event_capacity = 0;
+
+	free(g_record_queue);
+	g_record_queue = NULL;
+	g_record_queue_size = 0;
+	g_record_queue_capacity = 0;
 }
 
 u32
@@ -460,16 +2738,17 @@ t_write(u8 const *message, u32 length)
 	u32 const original_length = length;
 
 	while (length > 0) {
+		if (g_write_cursor >= g_write_end) {
+			if (!t__make_room(1)) goto e_flush;
+		}
+
 		u32 const limit = MIN(g_write_end - g_write_cursor, length);
 
 		memcpy(g_write_cursor, message, limit);
 		g_write_cursor += limit;
+		T__DEBUG_OUTPUT(g_debug_bytes_buffered, limit);
 		message += limit;
 		length -= limit;
-
-		if (g_write_cursor >= g_write_end) {
-			if (!t_flush()) goto e_flush;
-		}
 	}
 
 e_flush:
@@ -521,6 +2800,7 @@ t_writef(char const *format, ...)
 	}
 	va_end(vl);
 
+	T__DEBUG_OUTPUT(g_debug_bytes_formatted, render_size);
 	return t_write((u8 const *) g_write_f_buf, (u32) render_size);
 }
 
@@ -531,3 +2811,287 @@ t_writez(char const *string)
 
 	return t_write((u8 const *) string, strlen(string));
 }
+
+/* @SECTION(encoding) */
+/* Encodes `value` in decimal at `dst` (which must have room for at
+ * least 10 bytes) two digits at a time, returning the encoded length. */
+static inline u32
+t__encode_u32(u8 *dst, u32 value)
+{
+	u32 const length = 
+		value < 10 ? 1 :
+		value < 100 ? 2 :
+		value < 1000 ? 3 :
+		value < 10000 ? 4 :
+		value < 100000 ? 5 :
+		value < 1000000 ? 6 :
+		value < 10000000 ? 7 :
+		value < 100000000 ? 8 :
+		value < 1000000000 ? 9 : 10;
+
+	u8 *cursor = dst + length;
+	while (value >= 100) {
+		u32 const pair = (value % 100) * 2;
+		value /= 100;
+		*--cursor = g_digit_pairs[pair + 1];
+		*--cursor = g_digit_pairs[pair];
+	}
+	if (value >= 10) {
+		*--cursor = g_digit_pairs[value * 2 + 1];
+		*--cursor = g_digit_pairs[value * 2];
+	}
+	else {
+		*--cursor = '0' + value;
+	}
+	return length;
+}
+
+/* Makes sure there is `size` contiguous bytes available at the write 
+ * cursor, flushing (or growing within a frame) if needed. Returns NULL if that wasn't possible. */
+static inline u8 *
+t__reserve(u32 size)
+{
+	if ((u32) (g_write_end - g_write_cursor) < size) {
+		t__make_room(size);
+		if ((u32) (g_write_end - g_write_cursor) < size) {
+			return NULL;
+		}
+	}
+	return g_write_cursor;
+}
+
+u32
+t_write_csi_n(u32 n, u8 final)
+{
+	/* ESC [ <10 digits> <final> */
+	u8 *cursor = t__reserve(13);
+	if (!cursor) return 0;
+
+	u8 const *base = cursor;
+	*cursor++ = '\x1b';
+	*cursor++ = '[';
+	cursor += t__encode_u32(cursor, n);
+	*cursor++ = final;
+
+	g_write_cursor = cursor;
+	T__DEBUG_OUTPUT(g_debug_bytes_buffered, cursor - base);
+	return cursor - base;
+}
+
+u32
+t_write_csi_nn(u32 n0, u32 n1, u8 final)
+{
+	/* ESC [ <10 digits> ; <10 digits> <final> */
+	u8 *cursor = t__reserve(24);
+	if (!cursor) return 0;
+
+	u8 const *base = cursor;
+	*cursor++ = '\x1b';
+	*cursor++ = '[';
+	cursor += t__encode_u32(cursor, n0);
+	*cursor++ = ';';
+	cursor += t__encode_u32(cursor, n1);
+	*cursor++ = final;
+
+	g_write_cursor = cursor;
+	T__DEBUG_OUTPUT(g_debug_bytes_buffered, cursor - base);
+	return cursor - base;
+}
+
+/* Nearest 256 color code of a 24-bit color, in the 6x6x6 cube or on 
+ * the gray ramp. */
+static inline u8
+t__rgb_to_256(u32 color)
+{
+	static u8 const l_cube_points [] = { 
+		0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff, 
+	};
+	s32 const components [3] = { 
+		T_COLOR_RED(color), T_COLOR_GREEN(color), T_COLOR_BLUE(color),
+	};
+	s32 cube [3];
+	s32 cube_error = 0;
+
+	for (u32 i = 0; i < 3; ++i) {
+		s32 close_diff = 256;
+		for (u32 j = 0; j < ARRAY_LENGTH(l_cube_points); ++j) {
+			s32 const diff = ABS(l_cube_points[j] - components[i]);
+			if (diff < close_diff) {
+				cube[i] = j;
+				close_diff = diff;
+			}
+		}
+		cube_error += close_diff;
+	}
+
+	/* the gray ramp goes 0x08, 0x12, ..., 0xee */
+	s32 const average = (components[0] + components[1] + components[2]) / 3;
+	s32 const gray = MIN(23, MAX(0, (average - 0x08 + 5) / 10));
+	s32 const gray_level = 0x08 + 10 * gray;
+	s32 const gray_error = 
+		ABS(components[0] - gray_level) +
+		ABS(components[1] - gray_level) +
+		ABS(components[2] - gray_level);
+
+	if (gray_error < cube_error) {
+		return 232 + gray;
+	}
+	return 16 + 36 * cube[0] + 6 * cube[1] + cube[2];
+}
+
+/* Encodes the SGR parameters of one color (without separators). */
+static inline u8 *
+t__encode_sgr_color(u8 *cursor, u32 color, bool background)
+{
+	if (!color) {
+		*cursor++ = background ? '4' : '3';
+		*cursor++ = '9';
+		return cursor;
+	}
+
+	if (color & T_COLOR_RGB_BIT) {
+		if (!(g_capabilities & T_CAP_RGB)) {
+			color = t__rgb_to_256(color);
+			goto palette;
+		}
+		*cursor++ = background ? '4' : '3';
+		*cursor++ = '8';
+		*cursor++ = ';';
+		*cursor++ = '2';
+		*cursor++ = ';';
+		cursor += t__encode_u32(cursor, T_COLOR_RED(color));
+		*cursor++ = ';';
+		cursor += t__encode_u32(cursor, T_COLOR_GREEN(color));
+		*cursor++ = ';';
+		cursor += t__encode_u32(cursor, T_COLOR_BLUE(color));
+		return cursor;
+	}
+
+palette:
+	color &= 0xff;
+	/* reuse the parameters from the pre-encoded sequences */
+	if (background) {
+		memcpy(cursor, g_sgr_bg_256[color] + 2, T__SGR_SEQ_SIZE - 2);
+		return cursor + g_sgr_256_len[color] - 3;
+	}
+	memcpy(cursor, g_sgr_fg_256[color] + 2, T__SGR_SEQ_SIZE - 2);
+	return cursor + g_sgr_256_len[color] - 3;
+}
+
+u32
+t_color_encoded(u32 color)
+{
+	if ((color & T_COLOR_RGB_BIT) && !(g_capabilities & T_CAP_RGB)) {
+		return t__rgb_to_256(color);
+	}
+	return color;
+}
+
+u32
+t_write_sgr(u8 select, u32 foreground, u32 background)
+{
+	/* ESC [ 0 ; 38;2;255;255;255 ; 48;2;255;255;255 m, with some slack
+	 * for the fixed-size copies of the pre-encoded parameters */
+	if (!select) return 0;
+
+	u8 *cursor = t__reserve(64);
+	if (!cursor) return 0;
+
+	u8 const *base = cursor;
+	*cursor++ = '\x1b';
+	*cursor++ = '[';
+
+	bool const reset = select & T_SGR_RESET;
+	if (reset) {
+		/* defaults are implied by the reset */
+		if (!foreground) select &= ~T_SGR_FOREGROUND;
+		if (!background) select &= ~T_SGR_BACKGROUND;
+	}
+
+	/* a lone reset is the shorter `CSI m` */
+	if (reset && (select & (T_SGR_FOREGROUND | T_SGR_BACKGROUND))) {
+		*cursor++ = '0';
+		*cursor++ = ';';
+	}
+	if (select & T_SGR_FOREGROUND) {
+		cursor = t__encode_sgr_color(cursor, foreground, false);
+		*cursor++ = ';';
+	}
+	if (select & T_SGR_BACKGROUND) {
+		cursor = t__encode_sgr_color(cursor, background, true);
+		*cursor++ = ';';
+	}
+
+	/* replace the trailing separator, if any */
+	if (cursor[-1] == ';') {
+		--cursor;
+	}
+	*cursor++ = 'm';
+
+	g_write_cursor = cursor;
+	T__DEBUG_OUTPUT(g_debug_bytes_buffered, cursor - base);
+	return cursor - base;
+}
+
+u32
+t_write_foreground_256(u8 color_code)
+{
+	/* copying the whole slot lets the compiler use a fixed-size move */
+	u8 *cursor = t__reserve(T__SGR_SEQ_SIZE);
+	if (!cursor) return 0;
+
+	memcpy(cursor, g_sgr_fg_256[color_code], T__SGR_SEQ_SIZE);
+	g_write_cursor += g_sgr_256_len[color_code];
+	T__DEBUG_OUTPUT(g_debug_bytes_buffered, g_sgr_256_len[color_code]);
+	return g_sgr_256_len[color_code];
+}
+
+u32
+t_write_background_256(u8 color_code)
+{
+	u8 *cursor = t__reserve(T__SGR_SEQ_SIZE);
+	if (!cursor) return 0;
+
+	memcpy(cursor, g_sgr_bg_256[color_code], T__SGR_SEQ_SIZE);
+	g_write_cursor += g_sgr_256_len[color_code];
+	T__DEBUG_OUTPUT(g_debug_bytes_buffered, g_sgr_256_len[color_code]);
+	return g_sgr_256_len[color_code];
+}
+
+/* @SECTION(debug) */
+#ifdef TC_DEBUG_METRICS
+void
+t_debug_metrics_total(struct t_debug_metrics *out)
+{
+	out->bytes_buffered   = __atomic_load_n(&g_debug_bytes_buffered, __ATOMIC_RELAXED);
+	out->bytes_formatted  = __atomic_load_n(&g_debug_bytes_formatted, __ATOMIC_RELAXED);
+	out->bytes_flushed    = __atomic_load_n(&g_debug_bytes_flushed, __ATOMIC_RELAXED);
+	out->num_writes       = __atomic_load_n(&g_debug_num_writes, __ATOMIC_RELAXED);
+	out->num_short_writes = __atomic_load_n(&g_debug_num_short_writes, __ATOMIC_RELAXED);
+	out->seconds_blocked  = 1e-9 * __atomic_load_n(&g_debug_nanos_blocked, __ATOMIC_RELAXED);
+	out->bytes_sunk       = __atomic_load_n(&g_debug_bytes_sunk, __ATOMIC_RELAXED);
+	out->bytes_recorded   = __atomic_load_n(&g_debug_bytes_recorded, __ATOMIC_RELAXED);
+}
+
+void
+t_debug_metrics_frame_begin()
+{
+	t_debug_metrics_total(&g_debug_frame_base);
+}
+
+void
+t_debug_metrics_frame(struct t_debug_metrics *out)
+{
+	struct t_debug_metrics now;
+	t_debug_metrics_total(&now);
+
+	out->bytes_buffered   = now.bytes_buffered   - g_debug_frame_base.bytes_buffered;
+	out->bytes_formatted  = now.bytes_formatted  - g_debug_frame_base.bytes_formatted;
+	out->bytes_flushed    = now.bytes_flushed    - g_debug_frame_base.bytes_flushed;
+	out->num_writes       = now.num_writes       - g_debug_frame_base.num_writes;
+	out->num_short_writes = now.num_short_writes - g_debug_frame_base.num_short_writes;
+	out->seconds_blocked  = now.seconds_blocked  - g_debug_frame_base.seconds_blocked;
+	out->bytes_sunk       = now.bytes_sunk       - g_debug_frame_base.bytes_sunk;
+	out->bytes_recorded   = now.bytes_recorded   - g_debug_frame_base.bytes_recorded;
+}
+#endif /* TC_DEBUG_METRICS */
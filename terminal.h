@@ -35,29 +35,549 @@ enum t_poll_special
 	T_RIGHT,
 	T_LEFT,
 
+	/* see `t_mouse_enable`, the event parameters are the button (see
+	 * `t_mouse_button`), column and row (0-based) */
+	T_MOUSE_PRESS = 224,
+	T_MOUSE_RELEASE,
+	T_MOUSE_MOTION,
+	T_MOUSE_WHEEL,
+
 	/* particularly used in combination with `T_ERROR` */
 	T_UNKNOWN    = 240,
 	T_DISCARD,
 };
 
 #define T_POLL_CODE(modifier, value) \
-	(((modifier & 0xff) << 8) | (value & 0xff))
+	((((modifier) & 0xff) << 8) | ((value) & 0xff))
+
+enum t_mouse_button
+{
+	T_MOUSE_LEFT        = 0,
+	T_MOUSE_MIDDLE,
+	T_MOUSE_RIGHT,
+	T_MOUSE_NONE,       /* motion without a button held */
+
+	/* with `T_MOUSE_WHEEL` */
+	T_MOUSE_WHEEL_UP    = 0,
+	T_MOUSE_WHEEL_DOWN,
+	T_MOUSE_WHEEL_LEFT,
+	T_MOUSE_WHEEL_RIGHT,
+};
+
+/* Optional features of the master terminal that the output encoders
+ * may take advantage of. None are assumed by default. */
+enum t_capability
+{
+	T_CAP_REP    = 0x01, /* CSI n b, repeat the preceding character */
+	T_CAP_ERASE  = 0x02, /* CSI n X and CSI K erase with the current background */
+	T_CAP_RGB    = 0x04, /* SGR 38;2 and 48;2 24-bit colors */
+	T_CAP_SYNC   = 0x08, /* DEC private mode 2026, synchronized updates */
+};
+
+/* What `t_capabilities_query` found out about the master terminal. */
+struct t_terminal_info
+{
+	u32  capabilities;  /* detected `enum t_capability` flags */
+	u16  conformance;   /* DA1 service class, ex. 62 for VT220, 0 if unknown */
+	u16  type;          /* DA2 terminal type */
+	u16  firmware;      /* DA2 firmware version */
+	char version [64];  /* XTVERSION reply, ex. "XTerm(388)", "" if unknown */
+};
+
+/* Colors as understood by `t_write_sgr`: 0 is the terminal default, 
+ * 1-255 are 256 color codes, and `T_COLOR_RGB` makes 24-bit colors
+ * (which are approximated with 256 colors without `T_CAP_RGB`). */
+#define T_COLOR_DEFAULT      0
+#define T_COLOR_RGB_BIT      0x01000000
+#define T_COLOR_RGB(r, g, b) \
+	(T_COLOR_RGB_BIT | (((r) & 0xff) << 16) | (((g) & 0xff) << 8) | ((b) & 0xff))
+
+#define T_COLOR_RED(color)   (((color) >> 16) & 0xff)
+#define T_COLOR_GREEN(color) (((color) >>  8) & 0xff)
+#define T_COLOR_BLUE(color)  (((color)      ) & 0xff)
+
+enum t_sgr_select
+{
+	T_SGR_RESET      = 0x01,
+	T_SGR_FOREGROUND = 0x02,
+	T_SGR_BACKGROUND = 0x04,
+};
+
+/* How `t_flush` gets the output to the master terminal. */
+enum t_output_mode
+{
+	/* write(2) on the calling thread */
+	T_OUTPUT_DIRECT,
+
+	/* hand the buffer to a writer thread and carry on with the next 
+	 * one, only blocking once all T_WRITE_NBUFS buffers are in flight */
+	T_OUTPUT_THREADED,
+
+	/* make stdout non-blocking and write only what the terminal takes, 
+	 * keeping the rest queued for the next `t_flush` (see `t_backlog`),
+	 * up to T_WRITE_BUFSZ_MAX bytes past which writes are cut short */
+	T_OUTPUT_NONBLOCKING,
+};
+
+/* Stand-in for the master terminal, see `t_manager_setup_headless`. */
+struct t_headless
+{
+	s32       width;       /* what `t_query_size` reports */
+	s32       height;
+	s32       fd;          /* where the output goes, -1 keeps it in memory */
+	u8 const *input;       /* what `t_poll` reads, may be NULL */
+	u32       input_size;
+};
 
 bool
 t_manager_setup();
 
+/**
+ * Sets up without a TTY, for batch jobs and benchmarks: `t_query_size`
+ * reports a virtual size, `t_flush` writes to `headless->fd` or appends
+ * to memory (see `t_headless_output`), and `t_poll` reads from the given
+ * input (see `t_headless_input`) and nothing else once that runs out. 
+ * Output kept in memory only supports `T_OUTPUT_DIRECT`.
+ *
+ * @param headless The virtual terminal, copied.
+ *
+ * @return Whether the input could be copied.
+ */
+bool
+t_manager_setup_headless(struct t_headless const *headless);
+
 void
 t_manager_cleanup();
 
+/**
+ * Gives the size of the master terminal, or of the headless one. If
+ * there is no telling, goes by $COLUMNS and $LINES or else 80 by 24.
+ * The size is only queried again after a resize (see `t_resize_notify`),
+ * so this is cheap enough to call for every frame.
+ */
 void
 t_query_size(s32 *out_w, s32 *out_h);
 
+/**
+ * Has the next `t_query_size` query the size again. `t_manager_setup` 
+ * catches SIGWINCH to do this, so it is only needed if the signal is
+ * taken in some other way, for ex. blocked for a signalfd(2).
+ */
+void
+t_resize_notify();
+
+/**
+ * @return A number that changes whenever the size given by 
+ *     `t_query_size` does, for ex. to lay out again only then.
+ */
+u32
+t_size_generation();
+
+/**
+ * @return The descriptor `t_poll_batch` reads from, for ex. to wait for
+ *     input in poll(2), or -1 if the input is kept in memory.
+ */
+s32
+t_input_fd();
+
+/**
+ * @return The descriptor `t_flush` writes to, or -1 if the output is 
+ *     kept in memory.
+ */
+s32
+t_output_fd();
+
+/**
+ * @return Whether set up with `t_manager_setup_headless`.
+ */
+bool
+t_headless();
+
+/**
+ * Changes the size of the headless terminal.
+ */
+void
+t_headless_resize(s32 w, s32 h);
+
+/**
+ * Queues more input for `t_poll` to read on a headless terminal.
+ *
+ * @param data The input, copied.
+ * @param size The number of bytes in `data`.
+ *
+ * @return False if out of memory.
+ */
+bool
+t_headless_input(u8 const *data, u32 size);
+
+/**
+ * Flushes, then gives the output kept in memory by a headless terminal.
+ *
+ * @param out_size Set to the number of bytes output so far.
+ *
+ * @return The output, valid until the next flush, NULL if there was none.
+ */
+u8 const *
+t_headless_output(u32 *out_size);
+
+/**
+ * Forgets the output kept in memory so far.
+ */
+void
+t_headless_output_clear();
+
+u32
+t_capabilities();
+
+void
+t_capabilities_set(u32 capabilities);
+
+/**
+ * Sends the DA1, DA2, XTVERSION and DECRQM (synchronized updates) 
+ * queries without waiting for the replies, which `t_poll_batch` takes 
+ * in (and hides) as they arrive. Once the last reply is in, or `timeout`
+ * has passed, the detected capabilities are added to `t_capabilities`.
+ * Replies that come in later are still hidden, so from then on DCS 
+ * strings are never taken for alt+shift+p.
+ *
+ * @param timeout The number of seconds to wait for replies at most.
+ *
+ * @return Whether the queries could be sent.
+ */
+bool
+t_capabilities_query(double timeout);
+
+/**
+ * @return Whether `t_capabilities_query` is still waiting for replies.
+ */
+bool
+t_capabilities_pending();
+
+struct t_terminal_info const *
+t_terminal_info();
+
+/* CSI parameters kept in an event, the rest are dropped */
+#define T_EVENT_PARAMS_MAX 4
+
+/* A decoded key or mouse report (see `t_poll_batch`). */
+struct t_event
+{
+	u16     code;        /* T_POLL_CODE(modifiers, value) */
+	u8      num_params;
+	u16     params [T_EVENT_PARAMS_MAX]; /* of the CSI sequence, if any */
+	double  time;        /* when it was read, CLOCK_MONOTONIC seconds */
+};
+
+/**
+ * Reads all the input there is and decodes it in a single pass, taking
+ * in replies to `t_capabilities_query` on the way. Sequences cut short
+ * by a read are completed by the next ones, but an ESC, ESC [, ESC O or
+ * ESC P that nothing followed for T_ESCAPE_TIMEOUT is taken as typed 
+ * (see `t_input_timeout`).
+ *
+ * @param events Where to store the pending events, oldest first.
+ * @param capacity The number of events `events` holds, the others stay
+ *     pending for the next call.
+ *
+ * @return The number of events stored.
+ */
+u32
+t_poll_batch(struct t_event *events, u32 capacity);
+
+/**
+ * @return The number of seconds until input that stopped right after 
+ *     the introducer of a sequence is taken as typed, when `t_poll_batch`
+ *     should be called again even without more input, or -1 if there is
+ *     no such input.
+ */
+double
+t_input_timeout();
+
+/**
+ * Turns on SGR mouse reports (DEC private mode 1006), which come in as
+ * `T_MOUSE_*` events: presses, releases and the wheel, plus the motion 
+ * while a button is held. A run of motion events that nobody took yet
+ * is merged into the latest position, keeping the time of the first.
+ * `t_manager_cleanup` turns the reports off again.
+ *
+ * @param all_motion Whether to report motion without a button held.
+ *
+ * @return The number of bytes written.
+ */
+u32
+t_mouse_enable(bool all_motion);
+
+/**
+ * Turns off the mouse reports turned on by `t_mouse_enable`.
+ *
+ * @return The number of bytes written.
+ */
+u32
+t_mouse_disable();
+
+/**
+ * Like `t_poll_batch`, one event at a time.
+ *
+ * @return The code of the oldest pending event, or
+ *     T_POLL_CODE(T_ERROR, T_DISCARD) if there is none.
+ */
 u16
 t_poll();
 
+/**
+ * Switches the output mode. Leaving `T_OUTPUT_THREADED` waits until the 
+ * writer thread has written out everything handed to it.
+ *
+ * @param mode The desired mode.
+ *
+ * @return Whether the mode could be switched.
+ */
+bool
+t_output_mode_set(enum t_output_mode mode);
+
+enum t_output_mode
+t_output_mode();
+
+/**
+ * The number of flushed bytes the master terminal hasn't taken yet. A
+ * non-zero backlog means the terminal is behind, and producing more
+ * output will only add latency.
+ *
+ * @return The number of bytes still queued.
+ */
+u32
+t_backlog();
+
+/**
+ * Writes out everything written so far, unless a frame is open (see
+ * `t_frame_begin`), with a single writev(2) when the output is direct.
+ *
+ * @return The number of bytes written out or handed to the writer thread.
+ */
 u32
 t_flush();
 
+/**
+ * Flushes, then waits until the master terminal took everything, for
+ * ex. before freeing memory handed to `t_splice`. Does nothing while a
+ * frame is open.
+ */
+void
+t_drain();
+
+/**
+ * Opens a frame: until `t_frame_commit`, the write buffer grows instead
+ * of being flushed so the frame reaches the terminal as a whole. With
+ * `T_CAP_SYNC` the frame is also wrapped in a synchronized update. 
+ */
+void
+t_frame_begin();
+
+/**
+ * Closes the frame opened by `t_frame_begin` and flushes it.
+ *
+ * @return See `t_flush`.
+ */
+u32
+t_frame_commit();
+
+/* Key-to-photon latencies, see `t_latency`. */
+struct t_latency
+{
+	u64     count; /* of frames that showed input */
+	double  p50;   /* seconds */
+	double  p99;
+	double  max;
+};
+
+/**
+ * Traces the input read at `time` to the output: the next frame that
+ * changes anything is taken to show it, and the time since is recorded
+ * once that frame has been written out entirely. A frame shows all the
+ * input traced before it, and only the oldest counts.
+ *
+ * @param time When the input was read (see `t_event`).
+ */
+void
+t_latency_trace(double time);
+
+/**
+ * Summarizes the latencies recorded by `t_latency_trace` so far, within
+ * about 6% but never above the exact maximum.
+ *
+ * @param out Where to store the summary.
+ */
+void
+t_latency(struct t_latency *out);
+
+/**
+ * Redirects all output into a private buffer (which grows as needed)
+ * until `t_capture_end`, for ex. to encode something once for a single
+ * sink. Captures don't nest. Every thread has its own, so other threads
+ * may encode into captures while the output is left to one.
+ *
+ * @return Whether the capture started, not if one is going on already
+ *     or out of memory.
+ */
+bool
+t_capture_begin();
+
+/**
+ * Ends the capture started by `t_capture_begin`.
+ *
+ * @param out_size Where to store the number of bytes captured.
+ *
+ * @return The captured bytes, valid until the next `t_capture_begin` on
+ *     the same thread, or NULL if they didn't all fit in memory.
+ */
+u8 const *
+t_capture_end(u32 *out_size);
+
+/**
+ * @return Whether a capture is going on, on this thread.
+ */
+bool
+t_capturing();
+
+/**
+ * Has the calling thread only ever write into captures of its own, 
+ * dropping whatever it writes outside of one rather than having it race
+ * the other threads on the output. For threads that only encode.
+ */
+void
+t_capture_thread();
+
+/**
+ * Frees the buffer of the capture of this thread, for ex. before it 
+ * exits. Captured bytes may not be used anymore.
+ */
+void
+t_capture_free();
+
+/**
+ * Queues `data` to be written out in place after what was written so
+ * far, without copying it (unless capturing, or out of room to keep 
+ * track of the pieces). The memory must stay valid until `t_released`
+ * reaches the returned position.
+ *
+ * @param data The output.
+ * @param size The number of bytes in `data`.
+ *
+ * @return The position in the output stream just past `data`, 0 if it
+ *     was copied.
+ */
+u64
+t_splice(u8 const *data, u32 size);
+
+/**
+ * @return The position in the output stream up to which no queued 
+ *     bytes are referenced anymore, as they were written (or dropped).
+ *     Safe to call from any thread.
+ */
+u64
+t_released();
+
+/* Where the output written on this thread stood (see `t_write_mark`). */
+struct t_write_mark
+{
+	u8 const *at;
+	u32       epoch;
+};
+
+/**
+ * Marks the current position of the output written on this thread, to
+ * get hold of what is written from there on with `t_written_since`.
+ */
+struct t_write_mark
+t_write_mark();
+
+/**
+ * @param mark A mark taken on this thread.
+ * @param out_size Where to store the number of bytes written since.
+ *
+ * @return The bytes written on this thread since `mark`, valid until
+ *     the next write, or NULL if they are not in one piece in the write
+ *     buffer anymore (it was flushed, grown or switched meanwhile).
+ */
+u8 const *
+t_written_since(struct t_write_mark mark, u32 *out_size);
+
+/**
+ * Mirrors the output to `fd` as well (made non-blocking), for ex. a
+ * second pty or a recording. All sinks share the output as encoded 
+ * once, each written out as fast as it takes from a history of the 
+ * last T_SINK_HISTORY bytes. A sink that falls out of the history,
+ * or was just attached, waits for a `t_sink_resync` (see 
+ * `t_sink_resync_wanted`).
+ *
+ * O_NONBLOCK is set on the open file description rather than on `fd`,
+ * so whoever shares it (a dup(2) of stdout, an inherited pty or pipe)
+ * goes non-blocking too until the sink is detached or the process 
+ * exits. Open the sink on its own to keep it to the sink.
+ *
+ * @param fd The file descriptor to mirror to, which stays owned by 
+ *     the caller.
+ *
+ * @return The sink id, or -1 on failure.
+ */
+s32
+t_sink_attach(s32 fd);
+
+/**
+ * Stops mirroring to a sink, dropping whatever it hasn't taken yet.
+ * Sinks that can't be written to anymore are detached automatically.
+ *
+ * @param id The sink id.
+ */
+void
+t_sink_detach(s32 id);
+
+/**
+ * @return The id of a sink that lost track of the output and needs a
+ * `t_sink_resync`, or -1 if there is none.
+ */
+s32
+t_sink_resync_wanted();
+
+/**
+ * Brings a sink back in sync: `data` (copied) is sent to it alone, 
+ * and it carries on with the shared output from there. `data` should 
+ * repaint the screen as of everything flushed so far.
+ *
+ * @param id The sink id.
+ * @param data The repaint, for ex. from a `t_capture_begin` capture,
+ *     may be NULL if `size` is 0.
+ * @param size The size of `data` in bytes.
+ */
+void
+t_sink_resync(s32 id, u8 const *data, u32 size);
+
+/**
+ * Records the output to `fd` as an asciicast v2 file (for ex. to play 
+ * with `asciinema play`, or demos/replay.c), each `t_flush` making one
+ * timestamped event. Valid UTF-8 is recorded as it is, and other bytes
+ * past ASCII as U+FFFD like asciinema does, so the recording plays the
+ * same anywhere but is only byte-exact for UTF-8. The events are written
+ * by a thread of their own, so a slow disk doesn't hold up `t_flush`,
+ * and the recording stops once it falls T_RECORD_QUEUE_MAX bytes behind.
+ *
+ * @param fd The file descriptor to record to, which stays owned by the
+ *     caller.
+ * @param clock Gives the time in seconds, for ex. `app_uptime` to 
+ *     follow a virtual clock, or NULL for the monotonic clock.
+ *
+ * @return Whether the header could be written.
+ */
+bool
+t_record_start(s32 fd, double (*clock)());
+
+/**
+ * Writes out what is left to record and stops recording. Recording also
+ * stops on its own if writing fails.
+ */
+void
+t_record_stop();
+
 u32
 t_write(u8 const *message, u32 size);
 
@@ -70,6 +590,115 @@ t_writef(char const *format, ...);
 u32
 t_writez(char const *message);
 
+/* The `t_write_*` family encodes straight into the write buffer without
+ * going through vsnprintf(3), and should be preferred on hot paths. */
+
+/**
+ * Writes `CSI n <final>`, for ex. `t_write_csi_n(3, 'A')` moves the cursor
+ * up three rows.
+ *
+ * @param n The numeric parameter.
+ * @param final The final byte of the sequence.
+ *
+ * @return The number of bytes written.
+ */
+u32
+t_write_csi_n(u32 n, u8 final);
+
+/**
+ * Writes `CSI n0;n1 <final>`.
+ *
+ * @param n0 The first numeric parameter.
+ * @param n1 The second numeric parameter.
+ * @param final The final byte of the sequence.
+ *
+ * @return The number of bytes written.
+ */
+u32
+t_write_csi_nn(u32 n0, u32 n1, u8 final);
+
+/**
+ * Writes a single SGR sequence that (optionally) resets all attributes,
+ * then sets the selected colors, for ex. `CSI 0;38;5;N;48;5;M m`. Colors
+ * set back to default after a reset are left out.
+ *
+ * @param select Bits of `enum t_sgr_select` for what to emit.
+ * @param foreground The foreground color (see `T_COLOR_RGB`).
+ * @param background The background color (see `T_COLOR_RGB`).
+ *
+ * @return The number of bytes written.
+ */
+u32
+t_write_sgr(u8 select, u32 foreground, u32 background);
+
+/**
+ * @return The color as `t_write_sgr` sends it with the current 
+ *         capabilities, i.e. 24-bit colors approximated with 256 
+ *         colors without `T_CAP_RGB`.
+ */
+u32
+t_color_encoded(u32 color);
+
+/**
+ * Writes the pre-encoded SGR sequence for a 256 color foreground.
+ *
+ * @param color_code The 256 color code.
+ *
+ * @return The number of bytes written.
+ */
+u32
+t_write_foreground_256(u8 color_code);
+
+/**
+ * Writes the pre-encoded SGR sequence for a 256 color background.
+ *
+ * @param color_code The 256 color code.
+ *
+ * @return The number of bytes written.
+ */
+u32
+t_write_background_256(u8 color_code);
+
+/* @SECTION(debug) */
+struct t_debug_metrics
+{
+	u64    bytes_buffered;   /* stored into the write buffer, or spliced */
+	u64    bytes_formatted;  /* of which went through `t_writef` */
+	u64    bytes_flushed;    /* taken by write(2) on the terminal output */
+	u64    num_writes;       /* write(2) calls on it */
+	u64    num_short_writes; /* ...which didn't take everything */
+	double seconds_blocked;  /* spent inside them */
+	u64    bytes_sunk;       /* taken by the sinks, see `t_sink_attach` */
+	u64    bytes_recorded;   /* written to the recording, see `t_record_start` */
+};
+
+/* Only counted with -DTC_DEBUG_METRICS, zeroes otherwise. A "frame" is
+ * whatever happened since the last `t_debug_metrics_frame_begin`. */
+#ifdef TC_DEBUG_METRICS
+void
+t_debug_metrics_total(struct t_debug_metrics *out);
+
+void
+t_debug_metrics_frame_begin();
+
+void
+t_debug_metrics_frame(struct t_debug_metrics *out);
+#else
+static inline void
+t_debug_metrics_total(struct t_debug_metrics *out) 
+{
+	*out = (struct t_debug_metrics){0};
+}
+
+static inline void
+t_debug_metrics_frame_begin() { }
+
+static inline void
+t_debug_metrics_frame(struct t_debug_metrics *out) 
+{
+	*out = (struct t_debug_metrics){0};
+}
+#endif
 
 #define T_SEQ(Seq)           (Seq)
 
@@ -84,13 +713,13 @@ t_writez(char const *message);
 static inline u32
 t_cursor_show() 
 {
-	return t_writef(T_CURSOR_SHOW);
+	return t_writez(T_CURSOR_SHOW);
 }
 
 static inline u32
 t_cursor_hide() 
 {
-	return t_writef(T_CURSOR_HIDE);
+	return t_writez(T_CURSOR_HIDE);
 }
 
 static inline u32
@@ -98,40 +727,75 @@ t_cursor_pos(
 	u32 col, /* x */
 	u32 row  /* y */
 ) {
-	return t_writef(T_CURSOR_POS, row, col);
+	return t_write_csi_nn(row, col, 'H');
 }
 
 static inline u32
 t_cursor_up(
 	u32 amount
 ) {
-	return t_writef(T_CURSOR_UP, amount);
+	return t_write_csi_n(amount, 'A');
 }
 
 static inline u32
 t_cursor_down(
 	u32 amount
 ) {
-	return t_writef(T_CURSOR_DOWN, amount);
+	return t_write_csi_n(amount, 'B');
 }
 
 static inline u32
 t_cursor_forward(
 	u32 amount
 ) {
-	return t_writef(T_CURSOR_FORWARD, amount);
+	return t_write_csi_n(amount, 'C');
 }
 
 static inline u32
 t_cursor_back(
 	u32 amount
 ) {
-	return t_writef(T_CURSOR_BACK, amount);
+	return t_write_csi_n(amount, 'D');
+}
+
+/**
+ * The number of bytes `t_write_csi_n(n, ...)` would write.
+ *
+ * @param n The numeric parameter.
+ *
+ * @return The sequence length in bytes.
+ */
+static inline u32
+t_csi_n_size(
+	u32 n
+) {
+	u32 digits = 1;
+	while (n >= 10) {
+		n /= 10;
+		++digits;
+	}
+	return 3 + digits;
 }
 
 #define T_CLEAR              T_SEQ("\x1b[2J")
 #define T_RESET              T_SEQ("\x1b[0m")
 
+#define T_REPEAT             T_SEQ("\x1b[%ub")
+#define T_ERASE_CHARS        T_SEQ("\x1b[%uX")
+#define T_ERASE_LINE_RIGHT   T_SEQ("\x1b[K")
+
+#define T_SYNC_BEGIN         T_SEQ("\x1b[?2026h")
+#define T_SYNC_END           T_SEQ("\x1b[?2026l")
+
+#define T_MOUSE_BUTTONS      T_SEQ("\x1b[?1002;1006h")
+#define T_MOUSE_ALL          T_SEQ("\x1b[?1003;1006h")
+#define T_MOUSE_OFF          T_SEQ("\x1b[?1003;1002;1006l")
+
+#define T_SCROLL_REGION      T_SEQ("\x1b[%u;%ur")
+#define T_SCROLL_REGION_RESET T_SEQ("\x1b[r")
+#define T_SCROLL_UP          T_SEQ("\x1b[%uS")
+#define T_SCROLL_DOWN        T_SEQ("\x1b[%uT")
+
 #define T_FOREGROUND_256     T_SEQ("\x1b[38;5;%um")
 #define T_BACKGROUND_256     T_SEQ("\x1b[48;5;%um")
 
@@ -147,18 +811,87 @@ t_reset()
 	return t_writez(T_RESET);
 }
 
+/* requires `T_CAP_REP` */
+static inline u32
+t_repeat(
+	u32 amount
+) {
+	return t_write_csi_n(amount, 'b');
+}
+
+/* requires `T_CAP_ERASE` to erase with the current background */
+static inline u32
+t_erase_chars(
+	u32 amount
+) {
+	return t_write_csi_n(amount, 'X');
+}
+
+/* requires `T_CAP_ERASE` to erase with the current background */
+static inline u32
+t_erase_line_right() 
+{
+	return t_writez(T_ERASE_LINE_RIGHT);
+}
+
+/* requires `T_CAP_SYNC`, see `t_frame_begin` */
+static inline u32
+t_sync_begin() 
+{
+	return t_writez(T_SYNC_BEGIN);
+}
+
+static inline u32
+t_sync_end() 
+{
+	return t_writez(T_SYNC_END);
+}
+
+/* sets the top and bottom margins (DECSTBM, 1-based and inclusive), 
+ * which also moves the cursor home */
+static inline u32
+t_scroll_region(
+	u32 top,
+	u32 bottom
+) {
+	return t_write_csi_nn(top, bottom, 'r');
+}
+
+static inline u32
+t_scroll_region_reset() 
+{
+	return t_writez(T_SCROLL_REGION_RESET);
+}
+
+/* scrolls the rows within the margins up, exposing blank rows at the
+ * bottom (with the current background given `T_CAP_ERASE`) */
+static inline u32
+t_scroll_up(
+	u32 amount
+) {
+	return t_write_csi_n(amount, 'S');
+}
+
+/* see `t_scroll_up` */
+static inline u32
+t_scroll_down(
+	u32 amount
+) {
+	return t_write_csi_n(amount, 'T');
+}
+
 static inline u32
 t_foreground_256(
 	u8 color_code
 ) {
-	return t_writef(T_FOREGROUND_256, color_code);
+	return t_write_foreground_256(color_code);
 }
 
 static inline u32
 t_background_256(
 	u8 color_code
 ) {
-	return t_writef(T_BACKGROUND_256, color_code);
+	return t_write_background_256(color_code);
 }
 
 #endif /* INCLUDE__TERMINAL_H */
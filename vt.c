@@ -0,0 +1,503 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "terminal.h"
+#include "draw.h"
+#include "vt.h"
+
+enum vt__state
+{
+	VT__GROUND,
+	VT__ESCAPE,
+	VT__CSI,
+	VT__STRING,        /* DCS, OSC, APC, PM or SOS, skipped */
+	VT__STRING_ESCAPE, /* possibly the ST ending a string */
+};
+
+/* @SECTION(screen) */
+static inline void
+vt__erase(struct vt *vt, s32 y, s32 x0, s32 x1)
+{
+	/* erased cells take the current background, like xterm's */
+	struct cell *row = frame_cell_at(&vt->screen, 0, y);
+	for (s32 x = MAX(x0, 0); x < MIN(x1, vt->screen.width); ++x) {
+		row[x] = (struct cell){
+			.background = vt->background,
+			.content = ' ',
+		};
+	}
+}
+
+/* Scrolls the region up by `n` rows (down if negative). */
+static void
+vt__scroll(struct vt *vt, s32 n)
+{
+	s32 const height = vt->bottom - vt->top + 1;
+	s32 const count = MIN(ABS(n), height);
+	s32 const width = vt->screen.width;
+	struct cell *top = frame_cell_at(&vt->screen, 0, vt->top);
+
+	if (n > 0) {
+		memmove(top, top + count * width, GRID_SIZEOF(width, height - count));
+		for (s32 y = vt->bottom - count + 1; y <= vt->bottom; ++y) {
+			vt__erase(vt, y, 0, width);
+		}
+	}
+	else {
+		memmove(top + count * width, top, GRID_SIZEOF(width, height - count));
+		for (s32 y = vt->top; y < vt->top + count; ++y) {
+			vt__erase(vt, y, 0, width);
+		}
+	}
+}
+
+static void
+vt__line_feed(struct vt *vt)
+{
+	vt->wrap_pending = false;
+	if (vt->y == vt->bottom) {
+		vt__scroll(vt, 1);
+	}
+	else if (vt->y < vt->screen.height - 1) {
+		++vt->y;
+	}
+}
+
+static void
+vt__reverse_index(struct vt *vt)
+{
+	vt->wrap_pending = false;
+	if (vt->y == vt->top) {
+		vt__scroll(vt, -1);
+	}
+	else if (vt->y > 0) {
+		--vt->y;
+	}
+}
+
+static void
+vt__put(struct vt *vt, u8 content)
+{
+	if (vt->wrap_pending) {
+		vt->x = 0;
+		vt__line_feed(vt);
+	}
+
+	*frame_cell_at(&vt->screen, vt->x, vt->y) = (struct cell){
+		.foreground = vt->foreground,
+		.background = vt->background,
+		.content = content,
+	};
+	vt->last = content;
+
+	if (vt->x == vt->screen.width - 1) {
+		vt->wrap_pending = true;
+	}
+	else {
+		++vt->x;
+	}
+}
+
+static void
+vt__move_to(struct vt *vt, s32 x, s32 y)
+{
+	vt->x = MIN(MAX(x, 0), vt->screen.width - 1);
+	vt->y = MIN(MAX(y, 0), vt->screen.height - 1);
+	vt->wrap_pending = false;
+}
+
+static void
+vt__reset(struct vt *vt)
+{
+	vt->x = vt->y = 0;
+	vt->saved_x = vt->saved_y = 0;
+	vt->wrap_pending = false;
+	vt->foreground = 0;
+	vt->background = 0;
+	vt->top = 0;
+	vt->bottom = vt->screen.height - 1;
+	vt->last = ' ';
+	frame_zero_grid(&vt->screen);
+}
+
+/* @SECTION(sequences) */
+/* The `i`th parameter, or `fallback` if missing or zero. */
+static inline u32
+vt__param(struct vt *vt, u32 i, u32 fallback)
+{
+	return i < vt->num_params && vt->params[i] ? vt->params[i] : fallback;
+}
+
+/* Parses the color of an extended SGR 38 or 48 at `*i`, advancing it. */
+static u32
+vt__sgr_extended(struct vt *vt, u32 *i)
+{
+	u32 const *params = vt->params;
+	u32 const at = *i;
+
+	if (at + 2 < vt->num_params && params[at + 1] == 5) {
+		*i += 2;
+		return params[at + 2] & 0xff;
+	}
+	if (at + 4 < vt->num_params && params[at + 1] == 2) {
+		*i += 4;
+		return T_COLOR_RGB(params[at + 2], params[at + 3], params[at + 4]);
+	}
+
+	++vt->num_unknown;
+	*i = vt->num_params;
+	return 0;
+}
+
+static void
+vt__sgr(struct vt *vt)
+{
+	if (!vt->num_params) {
+		vt->foreground = 0;
+		vt->background = 0;
+		return;
+	}
+
+	for (u32 i = 0; i < vt->num_params; ++i) {
+		u32 const p = vt->params[i];
+
+		if (p == 0) {
+			vt->foreground = 0;
+			vt->background = 0;
+		}
+		else if (30 <= p && p <= 37)   vt->foreground = p - 30;
+		else if (90 <= p && p <= 97)   vt->foreground = p - 90 + 8;
+		else if (p == 38)              vt->foreground = vt__sgr_extended(vt, &i);
+		else if (p == 39)              vt->foreground = 0;
+		else if (40 <= p && p <= 47)   vt->background = p - 40;
+		else if (100 <= p && p <= 107) vt->background = p - 100 + 8;
+		else if (p == 48)              vt->background = vt__sgr_extended(vt, &i);
+		else if (p == 49)              vt->background = 0;
+		/* attributes like bold are not modeled, nor used */
+	}
+}
+
+static void
+vt__csi(struct vt *vt, u8 final)
+{
+	s32 const width = vt->screen.width;
+	s32 const height = vt->screen.height;
+
+	if (vt->private || vt->intermediate) {
+		/* modes (ex. DECTCEM, synchronized updates) and queries leave
+		 * the screen alone */
+		if (!(vt->private == '?' && (final == 'h' || final == 'l'))) {
+			++vt->num_unknown;
+		}
+		return;
+	}
+
+	switch (final) {
+	case 'H':
+	case 'f':
+		vt__move_to(vt, vt__param(vt, 1, 1) - 1, vt__param(vt, 0, 1) - 1);
+		break;
+
+	case 'A':
+		vt__move_to(vt, vt->x, vt->y - (s32) vt__param(vt, 0, 1));
+		break;
+	case 'B':
+		vt__move_to(vt, vt->x, vt->y + (s32) vt__param(vt, 0, 1));
+		break;
+	case 'C':
+		vt__move_to(vt, vt->x + (s32) vt__param(vt, 0, 1), vt->y);
+		break;
+	case 'D':
+		vt__move_to(vt, vt->x - (s32) vt__param(vt, 0, 1), vt->y);
+		break;
+	case 'G':
+	case '`':
+		vt__move_to(vt, vt__param(vt, 0, 1) - 1, vt->y);
+		break;
+	case 'd':
+		vt__move_to(vt, vt->x, vt__param(vt, 0, 1) - 1);
+		break;
+
+	case 'J': {
+		u32 const mode = vt__param(vt, 0, 0);
+		if (mode == 0) {
+			vt__erase(vt, vt->y, vt->x, width);
+			for (s32 y = vt->y + 1; y < height; ++y) {
+				vt__erase(vt, y, 0, width);
+			}
+		}
+		else if (mode == 1) {
+			for (s32 y = 0; y < vt->y; ++y) {
+				vt__erase(vt, y, 0, width);
+			}
+			vt__erase(vt, vt->y, 0, vt->x + 1);
+		}
+		else {
+			for (s32 y = 0; y < height; ++y) {
+				vt__erase(vt, y, 0, width);
+			}
+		}
+		vt->wrap_pending = false;
+		break;
+	}
+
+	case 'K': {
+		u32 const mode = vt__param(vt, 0, 0);
+		vt__erase(vt, vt->y,
+			mode == 0 ? vt->x : 0,
+			mode == 1 ? vt->x + 1 : width
+		);
+		vt->wrap_pending = false;
+		break;
+	}
+
+	case 'X':
+		vt__erase(vt, vt->y, vt->x, vt->x + vt__param(vt, 0, 1));
+		vt->wrap_pending = false;
+		break;
+
+	case 'b':
+		for (u32 n = MIN(vt__param(vt, 0, 1), (u32) (width * height)); n; --n) {
+			vt__put(vt, vt->last);
+		}
+		break;
+
+	case 'm':
+		vt__sgr(vt);
+		break;
+
+	case 'r': {
+		s32 const top = vt__param(vt, 0, 1) - 1;
+		s32 const bottom = MIN((s32) vt__param(vt, 1, height), height) - 1;
+		if (top < bottom) {
+			vt->top = top;
+			vt->bottom = bottom;
+			vt__move_to(vt, 0, 0);
+		}
+		break;
+	}
+
+	case 'S':
+		vt__scroll(vt, vt__param(vt, 0, 1));
+		break;
+	case 'T':
+		vt__scroll(vt, -(s32) vt__param(vt, 0, 1));
+		break;
+
+	default:
+		++vt->num_unknown;
+		break;
+	}
+}
+
+static void
+vt__escape(struct vt *vt, u8 final)
+{
+	switch (final) {
+	case 'D':
+		vt__line_feed(vt);
+		break;
+	case 'E':
+		vt->x = 0;
+		vt__line_feed(vt);
+		break;
+	case 'M':
+		vt__reverse_index(vt);
+		break;
+	case '7':
+		vt->saved_x = vt->x;
+		vt->saved_y = vt->y;
+		break;
+	case '8':
+		vt__move_to(vt, vt->saved_x, vt->saved_y);
+		break;
+	case 'c':
+		vt__reset(vt);
+		break;
+	default:
+		++vt->num_unknown;
+		break;
+	}
+}
+
+/* Carries out a C0 control, false if `c` is none. */
+static bool
+vt__control(struct vt *vt, u8 c)
+{
+	switch (c) {
+	case '\r':
+		vt->x = 0;
+		vt->wrap_pending = false;
+		return true;
+	case '\n':
+	case '\v':
+	case '\f':
+		/* no ONLCR here, the output is modeled as sent */
+		vt__line_feed(vt);
+		return true;
+	case '\b':
+		vt__move_to(vt, vt->x - 1, vt->y);
+		return true;
+	case '\a':
+	case '\0':
+		return true;
+	}
+	return c < 0x20 && c != '\x1b' && c != '\x18' && c != '\x1a';
+}
+
+/* @SECTION(interface) */
+struct vt *
+vt_init(struct vt *vt, s32 width, s32 height)
+{
+	memset(vt, 0, sizeof(*vt));
+	if (width <= 0 || height <= 0 ||
+	    !frame_alloc(&vt->screen, width, height))
+	{
+		return NULL;
+	}
+	vt__reset(vt);
+	return vt;
+}
+
+void
+vt_free(struct vt *vt)
+{
+	if (vt) {
+		frame_free(&vt->screen);
+	}
+}
+
+void
+vt_feed(struct vt *vt, u8 const *data, u32 size)
+{
+	vt->num_bytes += size;
+
+	for (u32 i = 0; i < size; ++i) {
+		u8 const c = data[i];
+
+		/* CAN and SUB abort any sequence, ESC starts over */
+		if (c == '\x18' || c == '\x1a') {
+			vt->state = VT__GROUND;
+			continue;
+		}
+		if (c == '\x1b' && vt->state != VT__STRING) {
+			vt->state = VT__ESCAPE;
+			vt->intermediate = 0;
+			continue;
+		}
+
+		switch (vt->state) {
+		case VT__GROUND:
+			if (!vt__control(vt, c)) {
+				vt__put(vt, c);
+			}
+			break;
+
+		case VT__ESCAPE:
+			if (c == '[') {
+				vt->state = VT__CSI;
+				vt->private = 0;
+				vt->intermediate = 0;
+				vt->num_params = 0;
+				memset(vt->params, 0, sizeof(vt->params));
+			}
+			else if (c == 'P' || c == ']' || c == '_' || c == '^' || c == 'X') {
+				vt->state = VT__STRING;
+			}
+			else if (vt__control(vt, c)) {
+				/* executed in the middle of the sequence */
+			}
+			else if (0x20 <= c && c <= 0x2f) {
+				/* ex. charset designations, skip the final byte too */
+				vt->intermediate = c;
+			}
+			else {
+				if (vt->intermediate) {
+					vt->intermediate = 0;
+				}
+				else {
+					vt__escape(vt, c);
+				}
+				vt->state = VT__GROUND;
+			}
+			break;
+
+		case VT__CSI:
+			if ('0' <= c && c <= '9') {
+				u32 const at = vt->num_params ? vt->num_params - 1 : 0;
+				vt->num_params = MAX(vt->num_params, 1);
+				if (at < VT_PARAMS_MAX) {
+					vt->params[at] = MIN(vt->params[at] * 10 + (c - '0'), 0xffff);
+				}
+			}
+			else if (c == ';' || c == ':') {
+				vt->num_params = MIN(MAX(vt->num_params, 1) + 1, VT_PARAMS_MAX + 1);
+			}
+			else if (0x3c <= c && c <= 0x3f) {
+				vt->private = c;
+			}
+			else if (0x20 <= c && c <= 0x2f) {
+				vt->intermediate = c;
+			}
+			else if (0x40 <= c && c <= 0x7e) {
+				vt->num_params = MIN(vt->num_params, VT_PARAMS_MAX);
+				vt__csi(vt, c);
+				vt->state = VT__GROUND;
+			}
+			else {
+				vt__control(vt, c);
+			}
+			break;
+
+		case VT__STRING:
+			if (c == '\x1b') {
+				vt->state = VT__STRING_ESCAPE;
+			}
+			else if (c == '\a') {
+				vt->state = VT__GROUND;
+			}
+			break;
+
+		case VT__STRING_ESCAPE:
+			vt->state = c == '\\' ? VT__GROUND : VT__STRING;
+			break;
+		}
+	}
+}
+
+u32
+vt_compare(struct vt *vt, struct frame *frame, s32 *out_x, s32 *out_y)
+{
+	s32 const width = MIN(vt->screen.width, frame->width);
+	s32 const height = MIN(vt->screen.height, frame->height);
+	u32 mismatches = 0;
+
+	for (s32 y = 0; y < height; ++y) {
+		for (s32 x = 0; x < width; ++x) {
+			struct cell const *want = frame_cell_at(frame, x, y);
+			struct cell const *have = frame_cell_at(&vt->screen, x, y);
+
+			u8 const want_content = want->content ? want->content : ' ';
+			u8 const have_content = have->content ? have->content : ' ';
+			u32 const want_background = want->content
+				? t_color_encoded(want->background) : 0;
+			u32 const want_foreground = want->content
+				? t_color_encoded(want->foreground) : 0;
+
+			if (want_content == have_content &&
+			    want_background == (u32) have->background && (
+			    want_content == ' ' ||
+			    want_foreground == (u32) have->foreground))
+			{
+				continue;
+			}
+
+			if (!mismatches) {
+				if (out_x) *out_x = x;
+				if (out_y) *out_y = y;
+			}
+			++mismatches;
+		}
+	}
+	return mismatches;
+}
@@ -0,0 +1,90 @@
+#ifndef INCLUDE__VT_H
+#define INCLUDE__VT_H
+
+#include "common.h"
+#include "draw.h"
+
+/* @TUNABLE VT_PARAMS_MAX (CSI parameters kept, the rest are ignored) */
+#ifndef VT_PARAMS_MAX
+#  define VT_PARAMS_MAX 16
+#endif
+
+/* A minimal model of the VT100/xterm screen the output is meant for,
+ * to check what the rasterizers send (see `vt_feed` and `vt_compare`).
+ * It knows cursor movement (CUP, CUU/CUD/CUF/CUB, CHA, VPA, CR, LF, BS),
+ * SGR colors (default, 16, 256 and 24-bit), erasing (ED, EL, ECH), REP,
+ * scroll regions (DECSTBM, SU, SD, IND, RI) and autowrap; anything else
+ * is counted in `num_unknown` and skipped. */
+struct vt
+{
+	/* what the terminal shows, colors as they were sent (see
+	 * `t_color_encoded`) */
+	struct frame  screen;
+
+	s32           x, y;
+	bool          wrap_pending;  /* the last column was just written */
+	s32           saved_x, saved_y;
+	u32           foreground;
+	u32           background;
+	s32           top, bottom;   /* scroll region, inclusive */
+	u8            last;          /* last printed character, for REP */
+
+	/* parser */
+	u8            state;
+	u8            private;       /* CSI private marker, ex. '?' */
+	u8            intermediate;
+	u32           params [VT_PARAMS_MAX];
+	u32           num_params;
+
+	/* statistics */
+	u64           num_bytes;
+	u64           num_unknown;   /* sequences not understood */
+};
+
+/**
+ * Sets up a blank screen of the given size, with the cursor at the top
+ * left and default colors.
+ *
+ * @param vt The screen model.
+ * @param width The number of columns (> 0).
+ * @param height The number of rows (> 0).
+ *
+ * @return The screen model, or NULL if out of memory.
+ */
+struct vt *
+vt_init(struct vt *vt, s32 width, s32 height);
+
+/**
+ * @param vt The screen model to free (its contents, not itself).
+ */
+void
+vt_free(struct vt *vt);
+
+/**
+ * Runs output through the screen model. Sequences may be split across
+ * calls.
+ *
+ * @param vt The screen model.
+ * @param data The output, for ex. from `t_headless_output`.
+ * @param size The number of bytes in `data`.
+ */
+void
+vt_feed(struct vt *vt, u8 const *data, u32 size);
+
+/**
+ * Compares the screen with a frame placed at its top left, cell by cell
+ * and as a terminal shows them: empty cells are blanks in the default
+ * colors, the foreground of blanks doesn't matter and the stencil is
+ * never shown. Only the cells of both are compared.
+ *
+ * @param vt The screen model.
+ * @param frame The frame supposedly shown.
+ * @param out_x Set to the column of the first mismatch, if any (NULL is OK).
+ * @param out_y Set to the row of the first mismatch, if any (NULL is OK).
+ *
+ * @return The number of mismatching cells.
+ */
+u32
+vt_compare(struct vt *vt, struct frame *frame, s32 *out_x, s32 *out_y);
+
+#endif /* INCLUDE__VT_H */